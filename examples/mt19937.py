@@ -10,8 +10,7 @@ mt = L.gens()
 
 s = Solver()
 rng = MT19937(mt)
-for b in random_bits:
-    s.add(rng.getrandbits(1) == b)
+rng.add_getrandbits(s, random_bits, 1)
 
 recovered_mt = list(s.solve().values())
 rng = MT19937(recovered_mt)
@@ -6,13 +6,18 @@ import shutil
 import subprocess
 import sys
 
+# Build m4ri with its OpenMP code paths unless XORSAT_NO_OPENMP is set. The extension
+# itself also needs OpenMP to honor the threads= argument of solve().
+OPENMP = not os.environ.get('XORSAT_NO_OPENMP')
+OPENMP_FLAGS = ['-fopenmp'] if OPENMP else []
+
 class build_ext(_build_ext):
     def build_extension(self, ext):
         def run(command):
             subprocess.check_call(command, cwd='xorsat/m4ri')
 
         run(['autoreconf', '--install'])
-        run(['./configure'])
+        run(['./configure'] + (['--enable-openmp'] if OPENMP else []))
         run(['make'])
 
         super().build_extension(ext)
@@ -53,11 +58,11 @@ if __name__ == '__main__':
             Extension(
                 name='xorsat._xorsat',
                 sources=['xorsat/_xorsatmodule.c'],
-                extra_compile_args=['-O3', '-march=native'],
+                extra_compile_args=['-O3', '-march=native'] + OPENMP_FLAGS,
                 include_dirs=['xorsat/m4ri'],
                 libraries=['m4ri'],
                 library_dirs=['xorsat/m4ri/.libs'],
-                extra_link_args=['-Wl,-rpath=$ORIGIN/m4ri/.libs'],
+                extra_link_args=['-Wl,-rpath=$ORIGIN/m4ri/.libs'] + OPENMP_FLAGS,
             ),
         ],
         cmdclass={
@@ -1,22 +1,26 @@
+import asyncio as _asyncio
+import functools as _functools
+
+from xorsat import _xorsat
 from xorsat._xorsat import *
 from xorsat._xorsat import _solve_zeros
 
 
-class Solver:
-    def __init__(self):
-        self.constraints = []
-
-    def add(self, *args):
-        self.constraints += args
-
-    def solve(self, all=False):
-        zeros = []
-        for constraint in self.constraints:
-            for z in constraint.zeros():
-                if z.is_constant():
-                    if z.compl == 1:
-                        raise ValueError('no solution')
-                    else:
-                        continue
-                zeros.append(z)
-        return _solve_zeros(zeros, all)
+class Solver(_xorsat.Solver):
+    async def solve_async(self, *args, **kwargs):
+        # solve() releases the GIL while it eliminates, so an executor thread keeps the
+        # event loop responsive
+        loop = _asyncio.get_running_loop()
+        solve = _functools.partial(self.solve, *args, **kwargs)
+        future = loop.run_in_executor(None, solve)
+        try:
+            return await _asyncio.shield(future)
+        except _asyncio.CancelledError:
+            # Stop the elimination at the next block boundary and wait for it, so the
+            # solver is usable again once the cancellation goes through
+            while not future.done():
+                self.cancel()
+                await _asyncio.wait([future], timeout=0.01)
+            if not future.cancelled():
+                future.exception()
+            raise
@@ -1,13 +1,21 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stddef.h>           /* offsetof() */
+#include <sys/mman.h>         /* mmap() */
+#include <unistd.h>           /* sysconf() */
 #include <m4ri/m4ri.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "structmember.h"     /* PyMemberDef */
 #include "xorsatmodule.h"
 
 
-static PyTypeObject BitExpr_Type, BitSet_Type, BitVec_Type, BitVecConstraint_Type,
-                    Constraint_Type, LinearSystem_Type, VarInfo_Type;
+static PyTypeObject BitExpr_Type, BitMatrix_Type, BitSet_Type, BitVec_Type,
+                    BitVecConstraint_Type, Constraint_Type, Factorization_Type,
+                    LinearMap_Type, LinearSystem_Type, MTEngine_Type, VarInfo_Type;
 
 /* ================================ VarInfo ================================= */
 
@@ -136,71 +144,235 @@ static PyTypeObject BitRef_Type = {
 
 /* ================================= BitSet ================================= */
 
+/* A BitSet is stored either densely, as BS_SIZE(bits) words, or sparsely, as the sorted
+   indices of its set bits. Sets are immutable once built. Sets built from indices or words
+   are sparse whenever they have at most BS_SPARSE_MAX(bits) bits set; an XOR with a dense
+   operand stays dense, so that it costs no more than a plain word loop. */
+#define BS_SPARSE_MAX(bits) ((Py_ssize_t)BS_SIZE(bits) / 4)
+
+static BitSetObject *
+bitset_alloc(PyTypeObject *type, Py_ssize_t bits, Py_ssize_t size, uint8_t sparse)
+{
+    BitSetObject *obj;
+
+    obj = PyObject_NewVar(BitSetObject, type, size);
+    if (obj == NULL)
+        return NULL;
+    obj->bits = bits;
+    obj->words = BS_SIZE(bits);
+    obj->dense = NULL;
+    obj->sparse = sparse;
+    return obj;
+}
+
 uint8_t
 bitset_test(BitSetObject *bs, Py_ssize_t i)
 {
-    return (bs->buf[i / WORD_SIZE] >> (i % WORD_SIZE)) & 1;
+    Py_ssize_t lo = 0, hi = Py_SIZE(bs), mid;
+
+    if (!bs->sparse)
+        return (bs->buf[i / WORD_SIZE] >> (i % WORD_SIZE)) & 1;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (bs->buf[mid] < (bitset_t)i)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < Py_SIZE(bs) && bs->buf[lo] == (bitset_t)i;
+}
+
+/* Returns the smallest set index that is at least i, or -1 if there is none. */
+Py_ssize_t
+bitset_next(BitSetObject *bs, Py_ssize_t i)
+{
+    Py_ssize_t lo = 0, hi = Py_SIZE(bs), mid, w;
+    bitset_t word;
+
+    if (i >= bs->bits)
+        return -1;
+
+    if (bs->sparse) {
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            if (bs->buf[mid] < (bitset_t)i)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo < Py_SIZE(bs) ? (Py_ssize_t)bs->buf[lo] : -1;
+    }
+
+    w = i / WORD_SIZE;
+    word = bs->buf[w] & (~(bitset_t)0 << (i % WORD_SIZE));
+    while (word == 0) {
+        if (++w == Py_SIZE(bs))
+            return -1;
+        word = bs->buf[w];
+    }
+    return w * WORD_SIZE + __builtin_ctzll(word);
 }
 
+/* XORs the set into `words`, which must hold at least BS_SIZE(bs->bits) words. */
 void
-bitset_set(BitSetObject *bs, Py_ssize_t i, uint8_t val)
+bitset_xor_into(BitSetObject *bs, bitset_t *words)
 {
-    bs->buf[i / WORD_SIZE] |= (bitset_t)val << (i % WORD_SIZE);
+    Py_ssize_t i;
+
+    if (bs->sparse) {
+        for (i = 0; i < Py_SIZE(bs); i++)
+            words[bs->buf[i] / WORD_SIZE] ^= (bitset_t)1 << (bs->buf[i] % WORD_SIZE);
+    } else {
+        for (i = 0; i < Py_SIZE(bs); i++)
+            words[i] ^= bs->buf[i];
+    }
 }
 
 PyObject *
 bitset_from_size(PyTypeObject *type, Py_ssize_t bits, int clear)
 {
     BitSetObject *obj;
-    Py_ssize_t size;
 
-    size = BS_SIZE(bits);
-    obj = PyObject_NewVar(BitSetObject, type, size);
+    obj = bitset_alloc(type, bits, BS_SIZE(bits), 0);
     if (obj == NULL)
         return NULL;
-    obj->bits = bits;
 
     if (clear)
-        memset(obj->buf, 0, size * sizeof(bitset_t));
+        memset(obj->buf, 0, Py_SIZE(obj) * sizeof(bitset_t));
+    obj->count = clear ? 0 : -1;
     return (PyObject *)obj;
 }
 
-void
-bitset_inplace_xor(BitSetObject *a, BitSetObject *b)
+/* Builds a set from `n` sorted, distinct indices. */
+PyObject *
+bitset_from_indices(PyTypeObject *type, Py_ssize_t bits, const bitset_t *indices,
+                    Py_ssize_t n)
 {
+    BitSetObject *obj;
     Py_ssize_t i;
 
-    assert(a->bits == b->bits);
-    for (i = 0; i < Py_SIZE(a); i++)
-        a->buf[i] ^= b->buf[i];
+    if (n > BS_SPARSE_MAX(bits)) {
+        obj = (BitSetObject *)bitset_from_size(type, bits, 1);
+        if (obj == NULL)
+            return NULL;
+        for (i = 0; i < n; i++)
+            obj->buf[indices[i] / WORD_SIZE] |= (bitset_t)1 << (indices[i] % WORD_SIZE);
+    } else {
+        obj = bitset_alloc(type, bits, n, 1);
+        if (obj == NULL)
+            return NULL;
+        memcpy(obj->buf, indices, n * sizeof(bitset_t));
+    }
+    obj->count = n;
+    return (PyObject *)obj;
+}
+
+/* Builds a set from BS_SIZE(bits) words, with no bits set past `bits`. */
+PyObject *
+bitset_from_words(PyTypeObject *type, Py_ssize_t bits, const bitset_t *words)
+{
+    BitSetObject *obj;
+    Py_ssize_t size = BS_SIZE(bits), count = 0, i, n;
+    bitset_t word;
+
+    for (i = 0; i < size; i++)
+        count += __builtin_popcountll(words[i]);
+
+    if (count > BS_SPARSE_MAX(bits)) {
+        obj = bitset_alloc(type, bits, size, 0);
+        if (obj == NULL)
+            return NULL;
+        memcpy(obj->buf, words, size * sizeof(bitset_t));
+    } else {
+        obj = bitset_alloc(type, bits, count, 1);
+        if (obj == NULL)
+            return NULL;
+        for (i = n = 0; i < size; i++) {
+            for (word = words[i]; word != 0; word &= word - 1)
+                obj->buf[n++] = i * WORD_SIZE + __builtin_ctzll(word);
+        }
+    }
+    obj->count = count;
+    return (PyObject *)obj;
 }
 
 // Assumes that a and b are the same size
 PyObject *
 bitset_xor_impl(BitSetObject *a, BitSetObject *b)
 {
-    BitSetObject *result;
-    Py_ssize_t i;
+    BitSetObject *result, *t;
+    Py_ssize_t i, j, n;
 
     assert(a->bits == b->bits);
-    result = (BitSetObject *)bitset_from_size(&BitSet_Type, a->bits, 0);
+    if (a->sparse && b->sparse) {
+        // Merge the two index lists, dropping the indices they share
+        for (i = j = n = 0; i < Py_SIZE(a) && j < Py_SIZE(b); n++) {
+            if (a->buf[i] == b->buf[j]) {
+                i++, j++, n--;
+            } else if (a->buf[i] < b->buf[j]) {
+                i++;
+            } else {
+                j++;
+            }
+        }
+        n += (Py_SIZE(a) - i) + (Py_SIZE(b) - j);
+        if (n > BS_SPARSE_MAX(a->bits)) {
+            result = (BitSetObject *)bitset_from_size(&BitSet_Type, a->bits, 1);
+            if (result == NULL)
+                return NULL;
+            bitset_xor_into(a, result->buf);
+            bitset_xor_into(b, result->buf);
+            result->count = n;
+            return (PyObject *)result;
+        }
+
+        result = bitset_alloc(&BitSet_Type, a->bits, n, 1);
+        if (result == NULL)
+            return NULL;
+        for (i = j = n = 0; i < Py_SIZE(a) || j < Py_SIZE(b); ) {
+            if (j == Py_SIZE(b) || (i < Py_SIZE(a) && a->buf[i] < b->buf[j])) {
+                result->buf[n++] = a->buf[i++];
+            } else if (i == Py_SIZE(a) || b->buf[j] < a->buf[i]) {
+                result->buf[n++] = b->buf[j++];
+            } else {
+                i++, j++;
+            }
+        }
+        result->count = n;
+        return (PyObject *)result;
+    }
+
+    // At least one side is dense, so the result is dense too. Its count is left for
+    // bitset_count_impl() to work out if anybody asks.
+    if (a->sparse) {
+        t = a, a = b, b = t;
+    }
+    result = bitset_alloc(&BitSet_Type, a->bits, Py_SIZE(a), 0);
     if (result == NULL)
         return NULL;
-
-    for (i = 0; i < Py_SIZE(result); i++)
-        result->buf[i] = a->buf[i] ^ b->buf[i];
+    if (b->sparse) {
+        memcpy(result->buf, a->buf, Py_SIZE(a) * sizeof(bitset_t));
+        bitset_xor_into(b, result->buf);
+    } else {
+        for (i = 0; i < Py_SIZE(a); i++)
+            result->buf[i] = a->buf[i] ^ b->buf[i];
+    }
+    result->count = -1;
     return (PyObject *)result;
 }
 
 Py_ssize_t
 bitset_count_impl(BitSetObject *bs)
 {
-    Py_ssize_t result, i;
+    Py_ssize_t i, n;
 
-    result = 0;
-    for (i = 0; i < Py_SIZE(bs); i++)
-        result += __builtin_popcountll(bs->buf[i]);
-    return result;
+    if (bs->count < 0) {
+        for (i = n = 0; i < Py_SIZE(bs); i++)
+            n += __builtin_popcountll(bs->buf[i]);
+        bs->count = n;
+    }
+    return bs->count;
 }
 
 static PyObject *
@@ -221,7 +393,7 @@ bitset_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
         PyErr_SetString(PyExc_ValueError, "number of bits cannot be negative");
         return NULL;
     }
-    return bitset_from_size(type, bits, 1);
+    return bitset_from_indices(type, bits, NULL, 0);
 }
 
 static Py_ssize_t
@@ -251,14 +423,64 @@ bitset_repr(BitSetObject *self)
     if (str == NULL)
         return PyErr_NoMemory();
 
-    for (i = 0; i < self->bits; i++)
-        str[i] = '0' + bitset_test(self, i);
+    memset(str, '0', self->bits);
+    for (i = bitset_next(self, 0); i >= 0; i = bitset_next(self, i + 1))
+        str[i] = '1';
 
     result = PyUnicode_FromStringAndSize(str, self->bits);
     PyMem_Free(str);
     return result;
 }
 
+/* Exposes the words of the set as a read-only 1-D array of uint64. Masks are shared
+   between expressions, so they can never be handed out as writable. A sparse set is
+   expanded into words on the first export. */
+static int
+bitset_getbuffer(BitSetObject *self, Py_buffer *view, int flags)
+{
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "BitSet is read-only");
+        return -1;
+    }
+    if (self->sparse && self->dense == NULL) {
+        self->dense = PyMem_Calloc(self->words + 1, sizeof(bitset_t));
+        if (self->dense == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        bitset_xor_into(self, self->dense);
+    }
+
+    view->obj = Py_NewRef(self);
+    view->buf = self->sparse ? self->dense : self->buf;
+    view->len = self->words * sizeof(bitset_t);
+    view->readonly = 1;
+    view->itemsize = sizeof(bitset_t);
+    view->format = (flags & PyBUF_FORMAT) ? "Q" : NULL;
+    view->ndim = 1;
+    view->shape = &self->words;
+    view->strides = &view->itemsize;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static void
+bitset_dealloc(BitSetObject *self)
+{
+    PyMem_Free(self->dense);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyMemberDef bitset_members[] = {
+    { "sparse", T_BOOL, offsetof(BitSetObject, sparse), READONLY, NULL },
+    { NULL },
+};
+
+static PyBufferProcs bitset_as_buffer = {
+    .bf_getbuffer = (getbufferproc)bitset_getbuffer,
+};
+
 static PySequenceMethods var_as_sequence = {
     .sq_length = (lenfunc)bitset_length,
     .sq_item = (ssizeargfunc)bitset_item,
@@ -269,14 +491,154 @@ static PyTypeObject BitSet_Type = {
     .tp_name = "xorsat.BitSet",
     .tp_basicsize = sizeof(BitSetObject),
     .tp_itemsize = sizeof(bitset_t),
-    .tp_dealloc = (destructor)PyObject_Free,
+    .tp_dealloc = (destructor)bitset_dealloc,
     .tp_repr = (reprfunc)bitset_repr,
     .tp_as_sequence = &var_as_sequence,
+    .tp_as_buffer = &bitset_as_buffer,
     .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
     .tp_doc = NULL,
+    .tp_members = bitset_members,
     .tp_new = bitset_new,
 };
 
+/* =============================== BitMatrix ================================ */
+
+PyObject *
+bitmatrix_create(PyTypeObject *type, mzd_t *M)
+{
+    BitMatrixObject *obj;
+
+    obj = (BitMatrixObject *)type->tp_alloc(type, 0);
+    if (obj == NULL) {
+        mzd_free(M);
+        return NULL;
+    }
+    obj->M = M;
+    return (PyObject *)obj;
+}
+
+static PyObject *
+bitmatrix_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    Py_ssize_t nrows, ncols;
+
+    if (!_PyArg_NoKeywords(type->tp_name, kwds))
+        return NULL;
+    if (!PyArg_ParseTuple(args, "nn", &nrows, &ncols))
+        return NULL;
+    if (nrows < 0 || ncols < 0) {
+        PyErr_SetString(PyExc_ValueError, "dimensions cannot be negative");
+        return NULL;
+    }
+    if (nrows >= INT_MAX || ncols >= INT_MAX) {
+        PyErr_SetString(PyExc_OverflowError, "dimensions must be <2^31-1");
+        return NULL;
+    }
+    return bitmatrix_create(type, mzd_init((rci_t)nrows, (rci_t)ncols));
+}
+
+static Py_ssize_t
+bitmatrix_length(BitMatrixObject *self)
+{
+    return self->M->nrows;
+}
+
+static PyObject *
+bitmatrix_repr(BitMatrixObject *self)
+{
+    return PyUnicode_FromFormat("<BitMatrix %dx%d>", self->M->nrows, self->M->ncols);
+}
+
+static PyObject *
+bitmatrix_get_nrows(BitMatrixObject *self, void *closure)
+{
+    return PyLong_FromLong(self->M->nrows);
+}
+
+static PyObject *
+bitmatrix_get_ncols(BitMatrixObject *self, void *closure)
+{
+    return PyLong_FromLong(self->M->ncols);
+}
+
+/* Exposes the matrix as a 2-D array of uint64 words, one row of the matrix per row of
+   the array. Bit j of a row lives in bit j % 64 of word j / 64. */
+static int
+bitmatrix_getbuffer(BitMatrixObject *self, Py_buffer *view, int flags)
+{
+    static word empty;
+    mzd_t *M = self->M;
+
+    // m4ri splits very large matrices over several allocations, in which case the
+    // rows cannot be described by a single stride.
+    if (M->nrows > 1 && mzd_row(M, M->nrows - 1) !=
+            mzd_row(M, 0) + (size_t)(M->nrows - 1) * M->rowstride) {
+        PyErr_SetString(PyExc_BufferError, "matrix is not stored contiguously");
+        return -1;
+    }
+    // Padded rows can only be described with strides
+    if (M->nrows > 1 && M->rowstride != M->width &&
+            ((flags & PyBUF_STRIDES) != PyBUF_STRIDES ||
+             (flags & PyBUF_C_CONTIGUOUS) == PyBUF_C_CONTIGUOUS)) {
+        PyErr_SetString(PyExc_BufferError, "matrix rows are padded");
+        return -1;
+    }
+
+    self->shape[0] = M->nrows;
+    self->shape[1] = M->width;
+    self->strides[0] = M->rowstride * sizeof(word);
+    self->strides[1] = sizeof(word);
+
+    view->obj = Py_NewRef(self);
+    view->buf = M->nrows > 0 ? (void *)mzd_row(M, 0) : (void *)&empty;
+    view->len = M->nrows * M->width * sizeof(word);
+    view->readonly = 0;
+    view->itemsize = sizeof(word);
+    view->format = (flags & PyBUF_FORMAT) ? "Q" : NULL;
+    view->ndim = (flags & PyBUF_ND) == PyBUF_ND ? 2 : 1;
+    view->shape = (flags & PyBUF_ND) == PyBUF_ND ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static void
+bitmatrix_dealloc(BitMatrixObject *self)
+{
+    mzd_free(self->M);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PySequenceMethods bitmatrix_as_sequence = {
+    .sq_length = (lenfunc)bitmatrix_length,
+};
+
+static PyBufferProcs bitmatrix_as_buffer = {
+    .bf_getbuffer = (getbufferproc)bitmatrix_getbuffer,
+};
+
+static PyGetSetDef bitmatrix_getset[] = {
+    { "nrows", (getter)bitmatrix_get_nrows, NULL, NULL, NULL },
+    { "ncols", (getter)bitmatrix_get_ncols, NULL, NULL, NULL },
+    { NULL },
+};
+
+static PyTypeObject BitMatrix_Type = {
+    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "xorsat.BitMatrix",
+    .tp_basicsize = sizeof(BitMatrixObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)bitmatrix_dealloc,
+    .tp_repr = (reprfunc)bitmatrix_repr,
+    .tp_as_sequence = &bitmatrix_as_sequence,
+    .tp_as_buffer = &bitmatrix_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .tp_doc = NULL,
+    .tp_getset = bitmatrix_getset,
+    .tp_new = bitmatrix_new,
+};
+
 /* ================================ BitExpr ================================= */
 
 PyObject *
@@ -305,7 +667,7 @@ bitexpr_from_bit(PyTypeObject *type, uint8_t bit, LinearSystemObject *system)
     if (result == NULL)
         return NULL;
 
-    result->mask = bitset_from_size(&BitSet_Type, system->bits, 1);
+    result->mask = bitset_from_indices(&BitSet_Type, system->bits, NULL, 0);
     if (result->mask == NULL) {
         Py_DECREF(result);
         return NULL;
@@ -465,34 +827,48 @@ bitexpr_invert(BitExprObject *self)
     return bitexpr_xor_bit(self, 1);
 }
 
+/* Returns the index in the system's variable table of the variable holding `bit`,
+   searching forward from `start`. */
+static Py_ssize_t
+bitexpr_find_var(LinearSystemObject *system, Py_ssize_t start, Py_ssize_t bit)
+{
+    VarInfoObject *var;
+
+    for (; start < system->vi_size; start++) {
+        var = (VarInfoObject *)system->vi_table[start];
+        if (bit < var->offset + var->bits)
+            break;
+    }
+    return start;
+}
+
 static PyObject *
 bitexpr_terms(BitExprObject *self)
 {
     LinearSystemObject *system;
+    BitSetObject *mask;
     VarInfoObject *var;
     PyObject *result, *term;
     Py_ssize_t num_terms, i, b, resi;
 
-    num_terms = bitset_count_impl((BitSetObject *)self->mask);
+    mask = (BitSetObject *)self->mask;
+    num_terms = bitset_count_impl(mask);
     result = PyTuple_New(num_terms);
     if (result == NULL)
         return NULL;
     resi = 0;
 
+    // Walk the set bits only, which matters for short expressions in huge systems
     system = (LinearSystemObject *)self->system;
-    for (i = 0; i < system->vi_size; i++) {
+    for (b = bitset_next(mask, 0), i = 0; b >= 0; b = bitset_next(mask, b + 1)) {
+        i = bitexpr_find_var(system, i, b);
         var = (VarInfoObject *)system->vi_table[i];
-        for (b = 0; b < var->bits; b++) {
-            if (!bitset_test((BitSetObject *)self->mask, var->offset + b))
-                continue;
-
-            term = bitref_create(&BitRef_Type, var, b);
-            if (term == NULL) {
-                Py_DECREF(result);
-                return NULL;
-            }
-            PyTuple_SET_ITEM(result, resi++, term);
+        term = bitref_create(&BitRef_Type, var, b - var->offset);
+        if (term == NULL) {
+            Py_DECREF(result);
+            return NULL;
         }
+        PyTuple_SET_ITEM(result, resi++, term);
     }
     return (PyObject *)result;
 }
@@ -517,6 +893,7 @@ static PyObject *
 bitexpr_repr(BitExprObject *self)
 {
     LinearSystemObject *system;
+    BitSetObject *mask;
     VarInfoObject *var;
     _PyUnicodeWriter writer;
     char buf[24];
@@ -527,28 +904,26 @@ bitexpr_repr(BitExprObject *self)
     writer.overallocate = 1;
 
     system = (LinearSystemObject *)self->system;
-    for (i = 0; i < system->vi_size; i++) {
+    mask = (BitSetObject *)self->mask;
+    for (b = bitset_next(mask, 0), i = 0; b >= 0; b = bitset_next(mask, b + 1)) {
+        i = bitexpr_find_var(system, i, b);
         var = (VarInfoObject *)system->vi_table[i];
-        for (b = 0; b < var->bits; b++) {
-            if (!bitset_test((BitSetObject *)self->mask, var->offset + b))
-                continue;
-
-            if (!first) {
-                if (_PyUnicodeWriter_WriteASCIIString(&writer, " ^ ", 3) < 0)
-                    goto error;
-            }
-            first = 0;
 
-            if (_PyUnicodeWriter_WriteStr(&writer, var->name) < 0)
+        if (!first) {
+            if (_PyUnicodeWriter_WriteASCIIString(&writer, " ^ ", 3) < 0)
                 goto error;
+        }
+        first = 0;
 
-            // If the variable is a single bit, do not append a suffix since that would
-            // be redundant.
-            if (var->bits != 1) {
-                int n = snprintf(buf, sizeof(buf), "_%zd", b);
-                if (_PyUnicodeWriter_WriteASCIIString(&writer, buf, n) < 0)
-                    goto error;
-            }
+        if (_PyUnicodeWriter_WriteStr(&writer, var->name) < 0)
+            goto error;
+
+        // If the variable is a single bit, do not append a suffix since that would
+        // be redundant.
+        if (var->bits != 1) {
+            int n = snprintf(buf, sizeof(buf), "_%zd", b - var->offset);
+            if (_PyUnicodeWriter_WriteASCIIString(&writer, buf, n) < 0)
+                goto error;
         }
     }
 
@@ -643,6 +1018,7 @@ bitvec_from_size(PyTypeObject *type, Py_ssize_t size, PyObject *system,
     if (obj == NULL)
         return NULL;
 
+    obj->M = NULL;
     for (i = 0; i < size; i++)
         obj->exprs[i] = NULL;
 
@@ -661,6 +1037,95 @@ bitvec_from_size(PyTypeObject *type, Py_ssize_t size, PyObject *system,
     return (PyObject *)obj;
 }
 
+/* Creates a packed vector of `size` bits, all 0. */
+PyObject *
+bitvec_from_matrix(PyTypeObject *type, Py_ssize_t size, PyObject *system)
+{
+    BitVecObject *obj;
+    Py_ssize_t bits = ((LinearSystemObject *)system)->bits;
+
+    if (size >= INT_MAX || bits >= INT_MAX - (Py_ssize_t)WORD_SIZE) {
+        PyErr_SetString(PyExc_OverflowError, "BitVec is too large to pack");
+        return NULL;
+    }
+    obj = (BitVecObject *)bitvec_from_size(type, size, system, 0);
+    if (obj == NULL)
+        return NULL;
+    obj->M = mzd_init((rci_t)size, BV_CONST_COL(bits) + 1);
+    return (PyObject *)obj;
+}
+
+static void
+bitvec_flip_const(BitVecObject *vec, word *row)
+{
+    Py_ssize_t col = BV_CONST_COL(((LinearSystemObject *)vec->system)->bits);
+    row[col / m4ri_radix] ^= m4ri_one << (col % m4ri_radix);
+}
+
+static void
+bitvec_xor_row(mzd_t *M, rci_t r, const word *src)
+{
+    word *dst = mzd_row(M, r);
+    wi_t i;
+
+    for (i = 0; i < M->width; i++)
+        dst[i] ^= src[i];
+}
+
+/* Returns a packed copy of vec, or a new reference to vec if it is already packed. */
+PyObject *
+bitvec_pack_impl(BitVecObject *vec)
+{
+    BitVecObject *result;
+    BitExprObject *expr;
+    Py_ssize_t i;
+    word *row;
+
+    if (vec->M != NULL)
+        return Py_NewRef(vec);
+
+    result = (BitVecObject *)bitvec_from_matrix(&BitVec_Type, Py_SIZE(vec), vec->system);
+    if (result == NULL)
+        return NULL;
+    for (i = 0; i < Py_SIZE(vec); i++) {
+        expr = (BitExprObject *)vec->exprs[i];
+        row = mzd_row(result->M, i);
+        bitset_xor_into((BitSetObject *)expr->mask, row);
+        if (expr->compl)
+            bitvec_flip_const(result, row);
+        result->exprs[i] = Py_NewRef(expr);
+    }
+    return (PyObject *)result;
+}
+
+/* Returns a borrowed reference to the i-th bit, building it first if vec is packed. */
+PyObject *
+bitvec_get(BitVecObject *vec, Py_ssize_t i)
+{
+    LinearSystemObject *system;
+    BitExprObject *expr;
+    Py_ssize_t col;
+    word *row;
+
+    if (vec->exprs[i] != NULL)
+        return vec->exprs[i];
+
+    system = (LinearSystemObject *)vec->system;
+    expr = (BitExprObject *)bitexpr_from_bit(&BitExpr_Type, 0, system);
+    if (expr == NULL)
+        return NULL;
+    row = mzd_row(vec->M, i);
+    col = BV_CONST_COL(system->bits);
+    expr->compl = (row[col / m4ri_radix] >> (col % m4ri_radix)) & 1;
+    Py_SETREF(expr->mask, bitset_from_words(&BitSet_Type, system->bits, row));
+    if (expr->mask == NULL) {
+        Py_DECREF(expr);
+        return NULL;
+    }
+    vec->exprs[i] = (PyObject *)expr;
+    return vec->exprs[i];
+}
+
 static PyObject *
 bitvec_from_sequence(PyTypeObject *type, PyObject *object)
 {
@@ -748,6 +1213,48 @@ bitvec_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
     return bitvec_from_sequence(type, object);
 }
 
+/* The packed counterpart of bitvec_bitwise_number(), given the bytes of the number. */
+static PyObject *
+bitvec_bitwise_bytes_packed(BitVecObject *vec, const char op, const uint8_t *buf)
+{
+    BitVecObject *result;
+    Py_ssize_t i;
+    word *row;
+    int b;
+
+    result = (BitVecObject *)bitvec_from_size(&BitVec_Type, Py_SIZE(vec), vec->system, 0);
+    if (result == NULL)
+        return NULL;
+    result->M = mzd_copy(NULL, vec->M);
+
+    for (i = 0; i < Py_SIZE(vec); i++) {
+        b = (buf[i / 8] >> (i % 8)) & 1;
+        row = mzd_row(result->M, i);
+        switch (op) {
+        case '^':
+            if (b)
+                bitvec_flip_const(result, row);
+            break;
+        case '&':
+            if (!b)
+                memset(row, 0, result->M->width * sizeof(word));
+            break;
+        case '|':
+            if (b) {
+                memset(row, 0, result->M->width * sizeof(word));
+                bitvec_flip_const(result, row);
+            }
+            break;
+        default:
+            Py_UNREACHABLE();
+        }
+        // Bits that pass through unchanged can share the expression already built
+        if (vec->exprs[i] != NULL && b == (op == '&'))
+            result->exprs[i] = Py_NewRef(vec->exprs[i]);
+    }
+    return (PyObject *)result;
+}
+
 PyObject *
 bitvec_bitwise_number(BitVecObject *vec, const char op, PyObject *num)
 {
@@ -763,10 +1270,18 @@ bitvec_bitwise_number(BitVecObject *vec, const char op, PyObject *num)
     size = Py_SIZE(vec);
     bytes = (size + 7) / 8;
     buf = (uint8_t *)PyMem_Malloc(bytes);
+    if (buf == NULL)
+        return PyErr_NoMemory();
     if (_PyLong_AsByteArray((PyLongObject *)num, buf, bytes,
                             PY_LITTLE_ENDIAN, Py_SIZE(num) < 0) < 0)
         goto error;
 
+    if (vec->M != NULL) {
+        result = (BitVecObject *)bitvec_bitwise_bytes_packed(vec, op, buf);
+        PyMem_Free(buf);
+        return (PyObject *)result;
+    }
+
     result = (BitVecObject *)bitvec_from_size(&BitVec_Type, size, vec->system, 0);
     if (result == NULL)
         goto error;
@@ -810,13 +1325,52 @@ error:
     return NULL;
 }
 
+/* XORs two vectors of which at least one is packed, with len(x) >= len(y). The result
+   is packed. */
 static PyObject *
-bitvec_xor(PyObject *a, PyObject *b)
+bitvec_xor_packed(BitVecObject *x, BitVecObject *y)
 {
-    BitVecObject *result, *x, *y, *tmp;
-    Py_ssize_t xsize, ysize, i;
+    BitVecObject *result, *px, *py;
+    Py_ssize_t i;
+    word *dst, *u, *v;
+    wi_t w;
 
-    if (!BitVec_Check(b))
+    px = (BitVecObject *)bitvec_pack_impl(x);
+    if (px == NULL)
+        return NULL;
+    py = (BitVecObject *)bitvec_pack_impl(y);
+    if (py == NULL) {
+        Py_DECREF(px);
+        return NULL;
+    }
+
+    result = (BitVecObject *)bitvec_from_matrix(&BitVec_Type, Py_SIZE(x), x->system);
+    if (result != NULL) {
+        for (i = 0; i < Py_SIZE(y); i++) {
+            dst = mzd_row(result->M, i);
+            u = mzd_row(px->M, i);
+            v = mzd_row(py->M, i);
+            for (w = 0; w < result->M->width; w++)
+                dst[w] = u[w] ^ v[w];
+        }
+        for (; i < Py_SIZE(x); i++) {
+            memcpy(mzd_row(result->M, i), mzd_row(px->M, i),
+                   result->M->width * sizeof(word));
+            result->exprs[i] = Py_XNewRef(px->exprs[i]);
+        }
+    }
+    Py_DECREF(px);
+    Py_DECREF(py);
+    return (PyObject *)result;
+}
+
+static PyObject *
+bitvec_xor(PyObject *a, PyObject *b)
+{
+    BitVecObject *result, *x, *y, *tmp;
+    Py_ssize_t xsize, ysize, i;
+
+    if (!BitVec_Check(b))
         return bitvec_bitwise_number((BitVecObject *)a, '^', b);
     else if (!BitVec_Check(a))
         return bitvec_bitwise_number((BitVecObject *)b, '^', a);
@@ -840,6 +1394,9 @@ bitvec_xor(PyObject *a, PyObject *b)
         return NULL;
     }
 
+    if (x->M != NULL || y->M != NULL)
+        return bitvec_xor_packed(x, y);
+
     result = (BitVecObject *)bitvec_from_size(&BitVec_Type, xsize, x->system, 0);
     if (result == NULL)
         return NULL;
@@ -889,6 +1446,12 @@ bitvec_invert(BitVecObject *self)
     result = (BitVecObject *)bitvec_from_size(&BitVec_Type, size, self->system, 0);
     if (result == NULL)
         return NULL;
+    if (self->M != NULL) {
+        result->M = mzd_copy(NULL, self->M);
+        for (i = 0; i < size; i++)
+            bitvec_flip_const(result, mzd_row(result->M, i));
+        return (PyObject *)result;
+    }
     for (i = 0; i < size; i++) {
         result->exprs[i] = bitexpr_invert((BitExprObject *)self->exprs[i]);
         if (result->exprs[i] == NULL) {
@@ -899,6 +1462,46 @@ bitvec_invert(BitVecObject *self)
     return (PyObject *)result;
 }
 
+/* Shifts a packed vector by moving its rows; 0 <= shift < len(x). */
+static PyObject *
+bitvec_shift_packed(BitVecObject *x, Py_ssize_t shift, shift_t shtype)
+{
+    BitVecObject *result;
+    Py_ssize_t size = Py_SIZE(x), i, j;
+
+    result = (BitVecObject *)bitvec_from_matrix(&BitVec_Type, size, x->system);
+    if (result == NULL)
+        return NULL;
+
+    for (i = 0; i < size; i++) {
+        // j is the bit of x that ends up in bit i, if any
+        switch (shtype) {
+        case SHIFT_SHL:
+            j = i - shift;
+            break;
+        case SHIFT_SHR:
+            j = i + shift < size ? i + shift : -1;
+            break;
+        case SHIFT_SAR:
+            j = Py_MIN(i + shift, size - 1);
+            break;
+        case SHIFT_ROL:
+            j = (i - shift + size) % size;
+            break;
+        case SHIFT_ROR:
+            j = (i + shift) % size;
+            break;
+        default:
+            Py_UNREACHABLE();
+        }
+        if (j < 0)
+            continue;
+        memcpy(mzd_row(result->M, i), mzd_row(x->M, j), x->M->width * sizeof(word));
+        result->exprs[i] = Py_XNewRef(x->exprs[j]);
+    }
+    return (PyObject *)result;
+}
+
 static PyObject *
 bitvec_shift(PyObject *a, PyObject *b, shift_t shtype)
 {
@@ -920,11 +1523,14 @@ bitvec_shift(PyObject *a, PyObject *b, shift_t shtype)
     }
 
     size = Py_SIZE(x);
+    shift %= size;
+    if (x->M != NULL)
+        return bitvec_shift_packed(x, shift, shtype);
+
     result = (BitVecObject *)bitvec_from_size(&BitVec_Type, size, x->system, 0);
     if (result == NULL)
         return NULL;
 
-    shift %= size;
     system = (LinearSystemObject *)x->system;
 
     switch (shtype) {
@@ -987,8 +1593,13 @@ bitvec_repr(BitVecObject *self)
     if (tuple == NULL)
         return NULL;
 
-    for (i = 0; i < size; i++)
+    for (i = 0; i < size; i++) {
+        if (bitvec_get(self, i) == NULL) {
+            Py_DECREF(tuple);
+            return NULL;
+        }
         PyTuple_SET_ITEM(tuple, i, Py_NewRef(self->exprs[i]));
+    }
     result = PyObject_Repr(tuple);
     Py_DECREF(tuple);
     return result;
@@ -1007,7 +1618,19 @@ bitvec_item(BitVecObject *self, Py_ssize_t i)
         PyErr_SetString(PyExc_IndexError, "BitVec index out of range");
         return NULL;
     }
-    return Py_NewRef(self->exprs[i]);
+    return Py_XNewRef(bitvec_get(self, i));
+}
+
+static PyObject *
+bitvec_pack(BitVecObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return bitvec_pack_impl(self);
+}
+
+static PyObject *
+bitvec_get_packed(BitVecObject *self, void *closure)
+{
+    return PyBool_FromLong(self->M != NULL);
 }
 
 static void
@@ -1018,6 +1641,7 @@ bitvec_dealloc(BitVecObject *self)
     for (i = 0; i < Py_SIZE(self); i++)
         Py_XDECREF(self->exprs[i]);
     Py_XDECREF(self->system);
+    mzd_xfree(self->M);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
@@ -1035,6 +1659,16 @@ static PySequenceMethods bitvec_as_sequence = {
     .sq_item = (ssizeargfunc)bitvec_item,
 };
 
+static PyMethodDef bitvec_methods[] = {
+    { "pack", (PyCFunction)bitvec_pack, METH_NOARGS, NULL },
+    { NULL },
+};
+
+static PyGetSetDef bitvec_getset[] = {
+    { "packed", (getter)bitvec_get_packed, NULL, NULL, NULL },
+    { NULL },
+};
+
 static PyTypeObject BitVec_Type = {
     .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "xorsat.BitVec",
@@ -1047,6 +1681,8 @@ static PyTypeObject BitVec_Type = {
     .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
     .tp_doc = NULL,
     .tp_richcompare = (richcmpfunc)bitvec_richcompare,
+    .tp_methods = bitvec_methods,
+    .tp_getset = bitvec_getset,
     .tp_new = bitvec_new,
 };
 
@@ -1201,6 +1837,8 @@ linearsystem_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
     self = PyObject_GC_New(LinearSystemObject, type);
     if (self == NULL)
         return NULL;
+    self->_expr_const[0] = self->_expr_const[1] = NULL;
+    self->gen_table = NULL;
 
     self->vi_size = PyDict_Size(kwds);
     self->vi_table = PyMem_Calloc(1, self->vi_size * sizeof(PyObject *));
@@ -1226,7 +1864,6 @@ linearsystem_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
     self->bits = offset;
 
     // Cache 0 and 1 for efficiency
-    self->_expr_const[0] = self->_expr_const[1] = NULL;
     for (i = 0; i < 2; i++) {
         self->_expr_const[i] = bitexpr_from_bit(&BitExpr_Type, i, self);
         if (self->_expr_const[i] == NULL)
@@ -1248,21 +1885,39 @@ linearsystem_gen_index(LinearSystemObject *self, Py_ssize_t index)
     BitExprObject *expr;
     VarInfoObject *var;
     Py_ssize_t i;
+    bitset_t bit;
+
+    // Generator bits are immutable, so every call shares the same expressions
+    if (self->gen_table == NULL) {
+        self->gen_table = PyMem_Calloc(self->bits, sizeof(PyObject *));
+        if (self->gen_table == NULL)
+            return PyErr_NoMemory();
+    }
 
     var = (VarInfoObject *)self->vi_table[index];
     vec = (BitVecObject *)bitvec_from_size(&BitVec_Type, var->bits, (PyObject *)self, 0);
     if (vec == NULL)
         return NULL;
     for (i = 0; i < var->bits; i++) {
-        expr = (BitExprObject *)bitexpr_from_bit(&BitExpr_Type, 0, self);
-        if (expr == NULL) {
-            Py_DECREF(vec);
-            return NULL;
+        bit = var->offset + i;
+        if (self->gen_table[bit] == NULL) {
+            expr = (BitExprObject *)bitexpr_from_bit(&BitExpr_Type, 0, self);
+            if (expr == NULL)
+                goto error;
+            Py_SETREF(expr->mask, bitset_from_indices(&BitSet_Type, self->bits, &bit, 1));
+            if (expr->mask == NULL) {
+                Py_DECREF(expr);
+                goto error;
+            }
+            self->gen_table[bit] = (PyObject *)expr;
         }
-        bitset_set((BitSetObject *)expr->mask, var->offset + i, 1);
-        vec->exprs[i] = (PyObject *)expr;
+        vec->exprs[i] = Py_NewRef(self->gen_table[bit]);
     }
     return (PyObject *)vec;
+
+error:
+    Py_DECREF(vec);
+    return NULL;
 }
 
 static PyObject *
@@ -1278,20 +1933,45 @@ linearsystem_gen(LinearSystemObject *self, PyObject *index)
     return linearsystem_gen_index(self, i);
 }
 
+/* Like linearsystem_gen_index(), but returns a packed vector. */
+static PyObject *
+linearsystem_gen_packed(LinearSystemObject *self, Py_ssize_t index)
+{
+    BitVecObject *vec;
+    VarInfoObject *var;
+    Py_ssize_t i;
+
+    var = (VarInfoObject *)self->vi_table[index];
+    vec = (BitVecObject *)bitvec_from_matrix(&BitVec_Type, var->bits, (PyObject *)self);
+    if (vec == NULL)
+        return NULL;
+    for (i = 0; i < var->bits; i++)
+        mzd_write_bit(vec->M, i, var->offset + i, 1);
+    return (PyObject *)vec;
+}
+
 static PyObject *
-linearsystem_gens(LinearSystemObject *self)
+linearsystem_gens(LinearSystemObject *self, PyObject *args, PyObject *kwds)
 {
+    static char *kwlist[] = { "packed", NULL };
     PyObject *result, *vec;
     Py_ssize_t i;
+    int packed = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|p:gens", kwlist, &packed))
+        return NULL;
 
     result = PyList_New(self->vi_size);
     if (result == NULL)
         return NULL;
 
     for (i = 0; i < self->vi_size; i++) {
-        vec = linearsystem_gen_index(self, i);
+        if (packed)
+            vec = linearsystem_gen_packed(self, i);
+        else
+            vec = linearsystem_gen_index(self, i);
         if (vec == NULL) {
-            Py_DECREF(vec);
+            Py_DECREF(result);
             return NULL;
         }
         PyList_SET_ITEM(result, i, vec);
@@ -1323,16 +2003,28 @@ linearsystem_repr(LinearSystemObject *self)
 static int
 linearsystem_traverse(LinearSystemObject *self, visitproc visit, void *arg)
 {
+    Py_ssize_t i;
+
     Py_VISIT(self->_expr_const[0]);
     Py_VISIT(self->_expr_const[1]);
+    if (self->gen_table != NULL) {
+        for (i = 0; i < self->bits; i++)
+            Py_VISIT(self->gen_table[i]);
+    }
     return 0;
 }
 
 static int
 linearsystem_clear(LinearSystemObject *self)
 {
+    Py_ssize_t i;
+
     Py_CLEAR(self->_expr_const[0]);
     Py_CLEAR(self->_expr_const[1]);
+    if (self->gen_table != NULL) {
+        for (i = 0; i < self->bits; i++)
+            Py_CLEAR(self->gen_table[i]);
+    }
     return 0;
 }
 
@@ -1346,12 +2038,13 @@ linearsystem_dealloc(LinearSystemObject *self)
     for (i = 0; i < self->vi_size; i++)
         Py_XDECREF(self->vi_table[i]);
     PyMem_Free(self->vi_table);
+    PyMem_Free(self->gen_table);
     PyObject_GC_Del(self);
 }
 
 static PyMethodDef linearsystem_methods[] = {
     { "gen", (PyCFunction)linearsystem_gen, METH_O, NULL },
-    { "gens", (PyCFunction)linearsystem_gens, METH_NOARGS, NULL },
+    { "gens", (PyCFunction)linearsystem_gens, METH_VARARGS | METH_KEYWORDS, NULL },
     { "variables", (PyCFunction)linearsystem_variables, METH_NOARGS, NULL },
     { NULL },
 };
@@ -1371,39 +2064,331 @@ static PyTypeObject LinearSystem_Type = {
     .tp_new = linearsystem_new,
 };
 
+/* ============================== Elimination =============================== */
+
+/* Returns the column of the first set bit of row r of M, or M->ncols if the row is
+   zero. */
+static rci_t
+mzd_row_lead(mzd_t const *M, rci_t r)
+{
+    word const *row = mzd_row(M, r);
+    word w;
+    wi_t i;
+
+    for (i = 0; i < M->width; i++) {
+        w = row[i];
+        if (i == M->width - 1)
+            w &= M->high_bitmask;
+        if (w != 0)
+            return i * m4ri_radix + __builtin_ctzll(w);
+    }
+    return M->ncols;
+}
+
+/* Finds one solution of the augmented system M (cols + 1 columns, the last one being
+   the right-hand side), which must already be in row echelon form with `rank` nonzero
+   rows. Free variables are set to 0. Returns -1 if the system has no solution. */
+static int
+echelon_solve(mzd_t const *M, rci_t rank, mzd_t *x)
+{
+    word const *row;
+    word *xrow;
+    rci_t cols, r, c;
+    wi_t i;
+    word dot;
+
+    cols = M->ncols - 1;
+    assert(x->nrows == 1 && x->ncols == cols);
+
+    // Only the last nonzero row can be [0 0 0 ... 0 0 0 1]
+    if (rank > 0 && mzd_row_lead(M, rank - 1) == cols)
+        return -1;
+
+    // x[c] = M[r,c+1:cols] * x[c+1:cols] + M[r,cols], computed a word at a time. The
+    // bits of x at and before c are still zero, so the whole row can be dotted.
+    xrow = mzd_row(x, 0);
+    for (r = rank; r--; ) {
+        row = mzd_row(M, r);
+        c = mzd_row_lead(M, r);
+        dot = 0;
+        for (i = c / m4ri_radix; i < x->width; i++)
+            dot ^= row[i] & xrow[i];
+        if ((__builtin_popcountll(dot) ^ mzd_read_bit(M, r, cols)) & 1)
+            xrow[c / m4ri_radix] |= m4ri_one << (c % m4ri_radix);
+    }
+    return 0;
+}
+
+/* Systems with at most this many variables skip m4ri: each row is kept in one to four
+   words plus the right-hand side, and eliminated with width-specialized kernels. */
+#define SMALL_MAX_COLS (4 * m4ri_radix)
+
+/* Defines small_echelonize_W(), which brings the n augmented rows at `rows`, `stride`
+   words apart, into row echelon form over their first `cols` columns, reduced if
+   `full` is set, storing the pivot column of each nonzero row in `pivots` and
+   returning the rank. The
+   variables take W words; the right-hand side sits just past them, in word W if xw is
+   set and in the last of the W words otherwise. With W a constant, the row operations
+   unroll into straight-line register code. */
+#define DEFINE_SMALL_ECHELONIZE(W)                                              \
+static rci_t                                                                    \
+small_echelonize_##W(word *rows, wi_t stride, rci_t n, rci_t cols,              \
+                     rci_t *pivots, int xw, int full)                           \
+{                                                                               \
+    word t, *pr, *ri;                                                           \
+    rci_t rank = 0, c, i;                                                       \
+    int k;                                                                      \
+                                                                                \
+    for (c = 0; c < cols && rank < n; c++) {                                    \
+        word bit = m4ri_one << (c % m4ri_radix);                                \
+        int wc = c / m4ri_radix;                                                \
+                                                                                \
+        for (i = rank; i < n && !(rows[i * stride + wc] & bit); i++)            \
+            ;                                                                   \
+        if (i == n)                                                             \
+            continue;                                                           \
+        pr = rows + rank * stride;                                              \
+        if (i != rank) {                                                        \
+            ri = rows + i * stride;                                             \
+            for (k = 0; k < W + xw; k++) {                                      \
+                t = pr[k]; pr[k] = ri[k]; ri[k] = t;                            \
+            }                                                                   \
+        }                                                                       \
+        for (i = full ? 0 : rank + 1; i < n; i++) {                             \
+            ri = rows + i * stride;                                             \
+            if (i != rank && (ri[wc] & bit)) {                                  \
+                for (k = 0; k < W; k++)                                         \
+                    ri[k] ^= pr[k];                                             \
+                if (xw)                                                         \
+                    ri[W] ^= pr[W];                                             \
+            }                                                                   \
+        }                                                                       \
+        pivots[rank++] = c;                                                     \
+    }                                                                           \
+    return rank;                                                                \
+}
+
+DEFINE_SMALL_ECHELONIZE(1)
+DEFINE_SMALL_ECHELONIZE(2)
+DEFINE_SMALL_ECHELONIZE(3)
+DEFINE_SMALL_ECHELONIZE(4)
+
+/* Runs the small_echelonize_W() kernel for rows with cols <= SMALL_MAX_COLS variables
+   and the right-hand side in column cols. The right-hand side is carried along but
+   never chosen as a pivot, so rows past the rank only have it left. */
+static rci_t
+small_echelonize(word *rows, wi_t stride, rci_t n, rci_t cols, rci_t *pivots, int full)
+{
+    int xw = cols > 0 && cols % m4ri_radix == 0;
+
+    switch ((cols + m4ri_radix - 1) / m4ri_radix) {
+    case 0:
+    case 1: return small_echelonize_1(rows, stride, n, cols, pivots, xw, full);
+    case 2: return small_echelonize_2(rows, stride, n, cols, pivots, xw, full);
+    case 3: return small_echelonize_3(rows, stride, n, cols, pivots, xw, full);
+    default: return small_echelonize_4(rows, stride, n, cols, pivots, xw, full);
+    }
+}
+
+/* Sets how many OpenMP threads m4ri may use in the calling thread and returns the
+   previous setting; 0 leaves it unchanged. Does nothing without OpenMP. Safe to call
+   without the GIL. */
+static int
+set_num_threads(int threads)
+{
+#ifdef _OPENMP
+    int prev = omp_get_max_threads();
+
+    if (threads > 0)
+        omp_set_num_threads(threads);
+    return prev;
+#else
+    return threads;
+#endif
+}
+
+/* Below this many target rows, or for rows of small systems, eliminate_columns() XORs
+   rows one by one instead of going through a matrix product. */
+#define ELIM_DIRECT_ROWS 64
+
+/* Clears columns cols[0..n) from rows [lo, hi) of M, using rows [src, src+n) of M as
+   pivots: row src+j must have a 1 in column cols[j] and a 0 in the other columns of
+   `cols`. For large blocks this is the product M[lo:hi] += G * M[src:src+n], where G
+   gathers the bits of M[lo:hi] at the pivot columns. */
+static void
+eliminate_columns(mzd_t *M, rci_t lo, rci_t hi, rci_t src, rci_t const *cols, rci_t n)
+{
+    mzd_t *G, *T, *S;
+    rci_t r, j;
+
+    if (lo >= hi || n == 0)
+        return;
+
+    if (hi - lo < ELIM_DIRECT_ROWS || M->ncols <= SMALL_MAX_COLS + 1) {
+        for (r = lo; r < hi; r++) {
+            for (j = 0; j < n; j++)
+                if (mzd_read_bit(M, r, cols[j]))
+                    mzd_combine_even_in_place(M, r, 0, M, src + j, 0);
+        }
+        return;
+    }
+
+    G = mzd_init(hi - lo, n);
+    for (r = lo; r < hi; r++) {
+        for (j = 0; j < n; j++)
+            if (mzd_read_bit(M, r, cols[j]))
+                mzd_write_bit(G, r - lo, j, 1);
+    }
+    T = mzd_init_window(M, lo, 0, hi, M->ncols);
+    S = mzd_init_window(M, src, 0, src + n, M->ncols);
+    mzd_addmul(T, G, S, 0);
+    mzd_free_window(S);
+    mzd_free_window(T);
+    mzd_free(G);
+}
+
+/* ============================== Worker pool =============================== */
+
+static void *
+worker_pool_run(void *ptr)
+{
+    worker_pool_t *pool = (worker_pool_t *)ptr;
+    Py_ssize_t i;
+
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->ntasks)
+        pool->func(pool->arg, i);
+    return NULL;
+}
+
+/* Calls func(arg, i) for every i in [0, ntasks) on up to `workers` threads, the calling
+   thread included. Tasks are handed out in index order as threads become free, so
+   callers should put the most expensive ones first. Must be called without the GIL. */
+static void
+worker_pool_map(void (*func)(void *, Py_ssize_t), void *arg, Py_ssize_t ntasks,
+                int workers)
+{
+    worker_pool_t pool = { func, arg, ntasks, 0 };
+    pthread_t *threads;
+    int n, started = 0;
+
+    n = (int)Py_MIN((Py_ssize_t)workers, ntasks);
+    threads = n > 1 ? (pthread_t *)PyMem_RawMalloc((n - 1) * sizeof(pthread_t)) : NULL;
+    // If a thread cannot be started, the others simply take on more tasks
+    if (threads != NULL) {
+        for (; started < n - 1; started++)
+            if (pthread_create(&threads[started], NULL, worker_pool_run, &pool) != 0)
+                break;
+    }
+    worker_pool_run(&pool);
+    while (started > 0)
+        pthread_join(threads[--started], NULL);
+    PyMem_RawFree(threads);
+}
+
+/* Returns the number of online CPUs, or 1 if it cannot be determined. */
+static int
+cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 && n < INT_MAX ? (int)n : 1;
+}
+
 /* ============================= solve_iterator ============================= */
 
+/* Moves it->x to the next solution. The solutions x + span(kernel) are enumerated in
+   Gray-code order: the i-th code differs from the previous one in bit ctz(i), so each
+   step is a single row XOR. */
+static void
+solveiter_step(SolveIterObject *it)
+{
+    rci_t n;
+
+    n = it->kernel->nrows;
+    it->index++;
+    if (n < 64 ? (it->index >> n) != 0 : it->index == 0)
+        it->done = 1;
+    else
+        mzd_combine_even_in_place(it->x, 0, 0, it->kernel, __builtin_ctzll(it->index), 0);
+}
+
 static PyObject *
 solveiter_next(SolveIterObject *it)
 {
-    // TODO: use gray code for more efficient enumeration
-
     PyObject *model;
-    mzd_t *result;
-    rci_t n, r;
-    int sentinel;
 
-    n = it->kernel->nrows;
-    if (it->state[n])
+    if (it->done)
         return NULL;  /* StopIteration */
 
-    result = mzd_copy(NULL, it->x);
-    for (r = 0; r < n; r++)
-        if (it->state[r])
-            mzd_combine_even_in_place(result, 0, 0, it->kernel, r, 0);
+    model = generate_model(it->x, (LinearSystemObject *)it->system, it->format);
+    if (model == NULL)
+        return NULL;
+    solveiter_step(it);
+    return model;
+}
 
-    sentinel = 1;
-    for (r = 0; r < n; r++) {
-        if ((it->state[r] ^= 1)) {
-            sentinel = 0;
-            break;
+/* Returns min(n, number of solutions left), without overflowing. */
+static Py_ssize_t
+solveiter_remaining(SolveIterObject *it, Py_ssize_t n)
+{
+    rci_t k = it->kernel->nrows;
+
+    if (it->done)
+        return 0;
+    if (k < 63 && ((uint64_t)1 << k) - it->index < (uint64_t)n)
+        return (Py_ssize_t)(((uint64_t)1 << k) - it->index);
+    return n;
+}
+
+static PyObject *
+solveiter_next_batch(SolveIterObject *it, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "", "out", NULL };
+    PyObject *out = Py_None;
+    Py_buffer view;
+    mzd_t *B;
+    word *dst;
+    Py_ssize_t n, rowbytes, i;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "n|O", kwlist, &n, &out))
+        return NULL;
+    if (n < 0) {
+        PyErr_SetString(PyExc_ValueError, "batch size cannot be negative");
+        return NULL;
+    }
+
+    rowbytes = it->x->width * sizeof(word);
+    if (Py_IsNone(out)) {
+        n = solveiter_remaining(it, n);
+        if (n >= INT_MAX) {
+            PyErr_SetString(PyExc_OverflowError, "batch size must be <2^31-1");
+            return NULL;
         }
+        B = mzd_init((rci_t)n, it->x->ncols);
+        for (i = 0; i < n; i++) {
+            memcpy(mzd_row(B, i), mzd_row(it->x, 0), rowbytes);
+            solveiter_step(it);
+        }
+        return bitmatrix_create(&BitMatrix_Type, B);
     }
-    it->state[n] = sentinel;
 
-    model = generate_model(result, (LinearSystemObject *)it->system);
-    mzd_free(result);
-    return model;
+    // Fill the caller's buffer with packed rows of x->width words each
+    if (PyObject_GetBuffer(out, &view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS) < 0)
+        return NULL;
+    if (rowbytes > 0 && view.len / rowbytes < n) {
+        PyErr_Format(PyExc_ValueError,
+            "buffer is too small for %zd rows of %zd bytes", n, rowbytes);
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    n = solveiter_remaining(it, n);
+    dst = (word *)view.buf;
+    for (i = 0; i < n; i++) {
+        memcpy((char *)dst + i * rowbytes, mzd_row(it->x, 0), rowbytes);
+        solveiter_step(it);
+    }
+    PyBuffer_Release(&view);
+    return PyLong_FromSsize_t(n);
 }
 
 static int
@@ -1427,10 +2412,15 @@ solveiter_dealloc(SolveIterObject *self)
     solveiter_clear(self);
     mzd_free(self->x);
     mzd_free(self->kernel);
-    PyMem_Free(self->state);
     PyObject_GC_Del(self);
 }
 
+static PyMethodDef solveiter_methods[] = {
+    { "next_batch", (PyCFunction)solveiter_next_batch, METH_VARARGS | METH_KEYWORDS,
+      NULL },
+    { NULL },
+};
+
 static PyTypeObject SolveIter_Type = {
     .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "xorsat.solve_iterator",
@@ -1443,168 +2433,4210 @@ static PyTypeObject SolveIter_Type = {
     .tp_clear = (inquiry)solveiter_clear,
     .tp_iter = PyObject_SelfIter,
     .tp_iternext = (iternextfunc)solveiter_next,
+    .tp_methods = solveiter_methods,
 };
 
-/* =========================== Module definitions =========================== */
+/* ================================= Solver ================================= */
 
-static PyObject *
-xorsat_lshr(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+/* Returns the transposed kernel of the first `rank` rows of M, restricted to the first
+   `cols` columns, with one basis vector per row. */
+static mzd_t *
+echelon_kernel(mzd_t *M, rci_t rank, rci_t cols)
 {
-    if (!_PyArg_CheckPositional("LShR", nargs, 2, 2))
-        return NULL;
-    return bitvec_shift(args[0], args[1], SHIFT_SHR);
-}
+    mzd_t *A, *kernel, *kernel_trans;
 
-static PyObject *
-xorsat_rotl(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
-{
-    if (!_PyArg_CheckPositional("RotL", nargs, 2, 2))
-        return NULL;
-    return bitvec_shift(args[0], args[1], SHIFT_ROL);
-}
+    if (rank == 0) {
+        kernel_trans = mzd_init(cols, cols);
+        mzd_set_ui(kernel_trans, 1);
+        return kernel_trans;
+    }
 
-static PyObject *
-xorsat_rotr(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
-{
-    if (!_PyArg_CheckPositional("RotR", nargs, 2, 2))
-        return NULL;
-    return bitvec_shift(args[0], args[1], SHIFT_ROR);
+    // mzd_kernel_left_pluq() overwrites its argument
+    A = mzd_submatrix(NULL, M, 0, 0, rank, cols);
+    kernel = mzd_kernel_left_pluq(A, 0);
+    mzd_free(A);
+    if (kernel == NULL)
+        return mzd_init(0, 0);
+    kernel_trans = mzd_transpose(NULL, kernel);
+    mzd_free(kernel);
+    return kernel_trans;
 }
 
+/* Wraps a particular solution x and the kernel in an iterator over all solutions.
+   Takes ownership of both matrices. */
 static PyObject *
-xorsat_par(PyObject *self, PyObject *arg)
+solveiter_create(LinearSystemObject *system, mzd_t *x, mzd_t *kernel,
+                 model_format_t format)
 {
-    BitVecObject *vec, *result;
-    BitExprObject *expr, *acc;
-    Py_ssize_t size, i;
+    SolveIterObject *it;
 
-    if (!BitVec_Check(arg)) {
-        PyErr_SetString(PyExc_TypeError, "argument must be a BitVec");
+    it = PyObject_GC_New(SolveIterObject, &SolveIter_Type);
+    if (it == NULL) {
+        mzd_free(x);
+        mzd_free(kernel);
         return NULL;
     }
 
-    vec = (BitVecObject *)arg;
-    size = Py_SIZE(vec);
-    result = (BitVecObject *)bitvec_from_size(&BitVec_Type, size, vec->system, 1);
-    if (result == NULL)
-        return NULL;
-
-    acc = (BitExprObject *)bitexpr_from_bit(&BitExpr_Type, 0,
-        (LinearSystemObject *)vec->system);
-    if (acc == NULL) {
-        Py_DECREF(result);
-        return NULL;
-    }
-    for (i = 0; i < size; i++) {
-        expr = (BitExprObject *)vec->exprs[i];
-        bitset_inplace_xor((BitSetObject *)acc->mask, (BitSetObject *)expr->mask);
-        acc->compl ^= expr->compl;
-    }
-    Py_SETREF(result->exprs[0], (PyObject *)acc);
-    return (PyObject *)result;
+    it->system = Py_NewRef(system);
+    it->x = x;
+    it->kernel = kernel;
+    it->index = 0;
+    it->format = format;
+    it->done = 0;
+    return (PyObject *)it;
 }
 
+/* Builds the result of a solve from the augmented system M, which must be in row
+   echelon form with `rank` nonzero rows: a model, or a solve_iterator over every
+   solution if `all` is set. M is left untouched, and is only read with the GIL
+   released. */
 static PyObject *
-xorsat_broadcast(PyObject *self, PyObject *args)
+solve_echelon(LinearSystemObject *system, mzd_t *M, rci_t rank, int all,
+              model_format_t format, int threads)
 {
-    BitVecObject *vec, *result;
-    Py_ssize_t index = 0, size, i;
+    PyObject *model;
+    mzd_t *x, *kernel = NULL;
+    rci_t cols;
+    int err, prev;
 
-    if (!PyArg_ParseTuple(args, "O!|n", &BitVec_Type, &vec, &index))
-        return NULL;
-    size = Py_SIZE(vec);
-    if (index < 0 || index >= size) {
-        PyErr_SetString(PyExc_IndexError, "index out of range");
+    cols = M->ncols - 1;
+    x = mzd_init(1, cols);
+    Py_BEGIN_ALLOW_THREADS
+    prev = set_num_threads(threads);
+    err = echelon_solve(M, rank, x);
+    if (err == 0 && all)
+        kernel = echelon_kernel(M, rank, cols);
+    set_num_threads(prev);
+    Py_END_ALLOW_THREADS
+    if (err < 0) {
+        PyErr_SetString(PyExc_ValueError, "no solution");
+        mzd_free(x);
         return NULL;
     }
 
-    result = (BitVecObject *)bitvec_from_size(&BitVec_Type, size, vec->system, 0);
-    if (result == NULL)
-        return NULL;
-
-    for (i = 0; i < size; i++)
-        result->exprs[i] = Py_NewRef(vec->exprs[index]);
-    return (PyObject *)result;
+    if (!all) {
+        model = generate_model(x, system, format);
+        mzd_free(x);
+        return model;
+    }
+    return solveiter_create(system, x, kernel, format);
 }
 
-PyObject *
-generate_model(mzd_t *x, LinearSystemObject *system)
-{
-    VarInfoObject *var;
-    PyObject *result, *one = NULL, *num = NULL, *bit = NULL;
-    Py_ssize_t i, b;
+/* Pending rows are merged into the basis once there are this many of them, or as many
+   as the system has columns, whichever is larger. */
+#define SOLVER_FLUSH_ROWS 1024
 
-    assert(x->nrows == 1);
+/* Pending rows are merged this many at a time, which bounds how long cancel() takes. */
+#define SOLVER_BLOCK_ROWS 256
 
-    result = PyDict_New();
-    if (result == NULL)
-        return NULL;
+/* Fails if another thread is eliminating on this solver with the GIL released. */
+static int
+solver_check_busy(SolverObject *self)
+{
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "solver is in use by another thread");
+        return -1;
+    }
+    return 0;
+}
 
-    one = PyLong_FromLong(1);
-    if (one == NULL)
-        goto error;
+/* Binds the solver to `system` on first use and allocates the row store. */
+static int
+solver_bind(SolverObject *self, PyObject *system)
+{
+    LinearSystemObject *s = (LinearSystemObject *)system;
+
+    if (self->system != NULL) {
+        if (!Py_Is(self->system, system)) {
+            PyErr_SetString(PyExc_TypeError,
+                "cannot mix constraints from different linear systems");
+            return -1;
+        }
+        return 0;
+    }
+    if (s->bits >= INT_MAX - 1) {
+        PyErr_SetString(PyExc_OverflowError, "number of bits in system must be <2^31-1");
+        return -1;
+    }
+    // One extra slot for a contradictory row, which briefly leads at the RHS column
+    self->pivots = (rci_t *)PyMem_Malloc((s->bits + 1) * sizeof(rci_t));
+    self->saved = (uint64_t *)PyMem_Calloc(s->bits + 1, sizeof(uint64_t));
+    if (self->pivots == NULL || self->saved == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->rows = mzd_init(64, (rci_t)s->bits + 1);
+    self->nrows = 0;
+    self->rank = 0;
+    self->system = Py_NewRef(system);
+    return 0;
+}
+
+/* Before basis rows [0, rank) have the columns cols[0..n) cleared, copies those that
+   belong to the innermost checkpoint and would change into the undo log. Each row is
+   saved at most once per checkpoint. */
+static int
+solver_save_rows(SolverObject *self, rci_t rank, rci_t const *cols, rci_t n)
+{
+    solver_checkpoint_t *top;
+    rci_t r, j, limit;
+
+    if (self->ncheckpoints == 0)
+        return 0;
+    top = &self->checkpoints[self->ncheckpoints - 1];
+    limit = Py_MIN(rank, top->rank);
+
+    for (r = 0; r < limit; r++) {
+        if (self->saved[r] == top->epoch)
+            continue;
+        for (j = 0; j < n; j++)
+            if (mzd_read_bit(self->rows, r, cols[j]))
+                break;
+        if (j == n)
+            continue;
+
+        if (self->undo == NULL || self->nundo == self->undo->nrows) {
+            rci_t capacity = self->undo == NULL ? 16 : 2 * self->undo->nrows;
+            mzd_t *undo = mzd_init(capacity, self->rows->ncols);
+            rci_t *undo_rows = (rci_t *)PyMem_Realloc(self->undo_rows,
+                                                      capacity * sizeof(rci_t));
+            if (undo_rows == NULL) {
+                mzd_free(undo);
+                PyErr_NoMemory();
+                return -1;
+            }
+            for (j = 0; j < self->nundo; j++)
+                memcpy(mzd_row(undo, j), mzd_row(self->undo, j), undo->width * sizeof(word));
+            mzd_xfree(self->undo);
+            self->undo = undo;
+            self->undo_rows = undo_rows;
+        }
+        memcpy(mzd_row(self->undo, (rci_t)self->nundo), mzd_row(self->rows, r),
+               self->undo->width * sizeof(word));
+        self->undo_rows[self->nundo++] = r;
+        self->saved[r] = top->epoch;
+    }
+    return 0;
+}
+
+/* First half of a merge: reduces the pending rows [rank, end) against the basis and
+   among themselves, leaving `*added` new basis rows right after the current basis.
+   Returns 1 if this uncovered a contradiction and 0 otherwise. Does not need the GIL. */
+static int
+solver_reduce_pending(SolverObject *self, rci_t end, rci_t *added)
+{
+    mzd_t *M = self->rows, *P;
+    rci_t cols = M->ncols - 1, rank = self->rank, n, r;
+    int found = 0;
+
+    // Clear the existing pivot columns from the pending rows, then reduce what is
+    // left among themselves. Rows that reduce to zero sink to the bottom.
+    eliminate_columns(M, rank, end, 0, self->pivots, rank);
+    if (cols <= SMALL_MAX_COLS && mzd_row(M, end - 1) ==
+            mzd_row(M, rank) + (size_t)(end - 1 - rank) * M->rowstride) {
+        // Small systems use the fixed-width kernels, which leave the right-hand side
+        // alone. A row that has nothing else left stands for [0 0 0 ... 0 0 0 1].
+        n = small_echelonize(mzd_row(M, rank), M->rowstride, end - rank, cols,
+                             self->pivots + rank, 1);
+        for (r = rank + n; r < end; r++) {
+            if (mzd_read_bit(M, r, cols)) {
+                self->pivots[rank + n++] = cols;
+                break;
+            }
+        }
+    } else {
+        P = mzd_init_window(M, rank, 0, end, M->ncols);
+        n = mzd_echelonize(P, 1);
+        mzd_free_window(P);
+
+        for (r = 0; r < n; r++)
+            self->pivots[rank + r] = mzd_row_lead(M, rank + r);
+    }
+
+    // A row [0 0 0 ... 0 0 0 1] can only be the last one. Keep it out of the basis;
+    // the solver stays inconsistent from now on.
+    if (n > 0 && self->pivots[rank + n - 1] == cols) {
+        n--;
+        found = !self->inconsistent;
+        self->inconsistent = 1;
+    }
+    *added = n;
+    return found;
+}
+
+/* Second half of a merge, once the undo log has been updated: clears the new pivot
+   columns from the old basis rows and appends the new rows. The rows up to `end` that
+   were reduced away are refilled from the end of the store. Does not need the GIL. */
+static void
+solver_extend_basis(SolverObject *self, rci_t end, rci_t added)
+{
+    mzd_t *M = self->rows;
+    rci_t rank = self->rank, holes, r;
+
+    eliminate_columns(M, 0, rank, rank, self->pivots + rank, added);
+    self->rank = rank += added;
+
+    holes = end - rank;
+    for (r = 0; r < holes && end + r < self->nrows; r++)
+        memcpy(mzd_row(M, rank + r), mzd_row(M, self->nrows - 1 - r), M->width * sizeof(word));
+    self->nrows -= holes;
+}
+
+/* Merges the pending rows into the basis, which stays in reduced row echelon form.
+   Returns 1 if this uncovered a contradiction, 0 if not, and -1 on error. The rows are
+   merged a block at a time with the GIL released while the solver is marked busy, and
+   cancel() takes effect between blocks. */
+static int
+solver_flush(SolverObject *self, int threads)
+{
+    rci_t end, added;
+    int found = 0, prev;
+
+    if (solver_check_busy(self) < 0)
+        return -1;
+    __atomic_store_n(&self->cancelled, 0, __ATOMIC_RELAXED);
+    self->busy = 1;
+
+    while (self->nrows > self->rank) {
+        if (__atomic_exchange_n(&self->cancelled, 0, __ATOMIC_RELAXED)) {
+            PyErr_SetString(PyExc_RuntimeError, "solve was cancelled");
+            goto error;
+        }
+        end = self->rank + Py_MIN(self->nrows - self->rank, SOLVER_BLOCK_ROWS);
+
+        Py_BEGIN_ALLOW_THREADS
+        prev = set_num_threads(threads);
+        found |= solver_reduce_pending(self, end, &added);
+        set_num_threads(prev);
+        Py_END_ALLOW_THREADS
+
+        // If this fails, the reduced rows simply stay pending
+        if (solver_save_rows(self, self->rank, self->pivots + self->rank, added) < 0)
+            goto error;
+
+        Py_BEGIN_ALLOW_THREADS
+        prev = set_num_threads(threads);
+        solver_extend_basis(self, end, added);
+        set_num_threads(prev);
+        Py_END_ALLOW_THREADS
+    }
+
+    self->busy = 0;
+    return found;
+
+error:
+    self->busy = 0;
+    return -1;
+}
+
+/* Flushes once enough rows are pending, raising if that uncovers a contradiction. */
+static int
+solver_maybe_flush(SolverObject *self)
+{
+    if (self->system == NULL)
+        return 0;
+    if (self->nrows - self->rank < Py_MAX(self->rows->ncols, SOLVER_FLUSH_ROWS))
+        return 0;
+    switch (solver_flush(self, 0)) {
+    case -1:
+        return -1;
+    case 1:
+        PyErr_SetString(PyExc_ValueError, "no solution");
+        return -1;
+    }
+    return 0;
+}
+
+/* Makes room for `extra` more rows in the store, growing it geometrically. */
+static int
+solver_reserve(SolverObject *self, Py_ssize_t extra)
+{
+    mzd_t *rows;
+    Py_ssize_t capacity;
+    rci_t r;
+
+    if (self->nrows + extra <= self->rows->nrows)
+        return 0;
+    if (self->nrows + extra >= INT_MAX) {
+        PyErr_SetString(PyExc_OverflowError, "number of equations must be <2^31");
+        return -1;
+    }
+
+    capacity = Py_MAX(2 * (Py_ssize_t)self->rows->nrows, self->nrows + extra);
+    capacity = Py_MIN(capacity, INT_MAX - 1);
+    rows = mzd_init((rci_t)capacity, self->rows->ncols);
+    for (r = 0; r < self->nrows; r++)
+        memcpy(mzd_row(rows, r), mzd_row(self->rows, r), rows->width * sizeof(word));
+    mzd_free(self->rows);
+    self->rows = rows;
+    return 0;
+}
+
+/* Returns the next free row of the store, cleared. Space must have been reserved. */
+static word *
+solver_push_row(SolverObject *self)
+{
+    word *row;
+
+    assert(self->nrows < self->rows->nrows);
+    row = mzd_row(self->rows, self->nrows++);
+    memset(row, 0, self->rows->width * sizeof(word));
+    return row;
+}
+
+/* Flips the right-hand side of a row of the store. */
+static void
+solver_flip_rhs(SolverObject *self, word *row)
+{
+    rci_t cols = self->rows->ncols - 1;
+    row[cols / m4ri_radix] ^= m4ri_one << (cols % m4ri_radix);
+}
+
+static void
+row_xor_bitexpr(SolverObject *self, word *row, BitExprObject *expr)
+{
+    bitset_xor_into((BitSetObject *)expr->mask, row);
+    if (expr->compl)
+        solver_flip_rhs(self, row);
+}
+
+/* XORs a row in the layout of a packed BitVec into a row of the store. */
+static void
+row_xor_packed(SolverObject *self, word *row, const word *src)
+{
+    Py_ssize_t col, w;
+
+    for (w = 0; w < (Py_ssize_t)BS_SIZE(self->rows->ncols - 1); w++)
+        row[w] ^= src[w];
+    col = BV_CONST_COL(self->rows->ncols - 1);
+    if ((src[col / m4ri_radix] >> (col % m4ri_radix)) & 1)
+        solver_flip_rhs(self, row);
+}
+
+/* XORs bit i of vec into a row of the store, straight from its packed row if it has
+   one. */
+static void
+row_xor_bitvec(SolverObject *self, word *row, BitVecObject *vec, Py_ssize_t i)
+{
+    if (vec->M == NULL)
+        row_xor_bitexpr(self, row, (BitExprObject *)vec->exprs[i]);
+    else
+        row_xor_packed(self, row, mzd_row(vec->M, i));
+}
+
+/* Drops the last row again if it turned out to be 0 == 0. */
+static void
+solver_pop_if_trivial(SolverObject *self, word *row)
+{
+    wi_t i;
+
+    for (i = 0; i < self->rows->width; i++)
+        if (row[i] != 0)
+            return;
+    self->nrows--;
+}
+
+/* Adds the equation lhs == rhs, where each side is a BitExpr or a bit. rhs may be NULL
+   to mean 0. */
+static int
+solver_add_bitexpr_pair(SolverObject *self, PyObject *lhs, PyObject *rhs)
+{
+    PyObject *sides[2] = { lhs, rhs };
+    word *row;
+    int bit, k;
+
+    for (k = 0; k < 2 && sides[k] != NULL; k++) {
+        if (BitExpr_Check(sides[k]) &&
+                solver_bind(self, ((BitExprObject *)sides[k])->system) < 0)
+            return -1;
+    }
+    if (self->system == NULL) {
+        PyErr_SetString(PyExc_TypeError,
+            "at least one of the arguments must be a BitExpr");
+        return -1;
+    }
+    if (solver_reserve(self, 1) < 0)
+        return -1;
+
+    row = solver_push_row(self);
+    for (k = 0; k < 2 && sides[k] != NULL; k++) {
+        if (BitExpr_Check(sides[k])) {
+            row_xor_bitexpr(self, row, (BitExprObject *)sides[k]);
+            continue;
+        }
+        bit = getbit(sides[k], "xor operand must be 0, 1, or BitExpr");
+        if (bit < 0) {
+            self->nrows--;
+            return -1;
+        }
+        if (bit)
+            solver_flip_rhs(self, row);
+    }
+    solver_pop_if_trivial(self, row);
+    return 0;
+}
+
+static int
+solver_add_bitvec_pair(SolverObject *self, PyObject *lhs, PyObject *rhs)
+{
+    PyObject *sides[2] = { lhs, rhs };
+    BitVecObject *vec;
+    uint8_t *bytes[2] = { NULL, NULL };
+    Py_ssize_t size = 0, n, i;
+    word *row;
+    int k, result = -1;
+
+    for (k = 0; k < 2; k++) {
+        if (BitVec_Check(sides[k])) {
+            vec = (BitVecObject *)sides[k];
+            if (solver_bind(self, vec->system) < 0)
+                return -1;
+            size = Py_MAX(size, Py_SIZE(vec));
+        }
+    }
+
+    // An integer side is truncated to the width of the vector it is compared with,
+    // exactly like BitVec ^ int.
+    for (k = 0; k < 2; k++) {
+        if (BitVec_Check(sides[k]))
+            continue;
+        if (!PyLong_Check(sides[k])) {
+            PyErr_Format(PyExc_TypeError, "cannot compare BitVec with '%.200s'",
+                Py_TYPE(sides[k])->tp_name);
+            goto done;
+        }
+        n = (size + 7) / 8;
+        bytes[k] = (uint8_t *)PyMem_Malloc(n);
+        if (bytes[k] == NULL) {
+            PyErr_NoMemory();
+            goto done;
+        }
+        if (_PyLong_AsByteArray((PyLongObject *)sides[k], bytes[k], n,
+                                PY_LITTLE_ENDIAN, Py_SIZE(sides[k]) < 0) < 0)
+            goto done;
+    }
+
+    if (solver_reserve(self, size) < 0)
+        goto done;
+    for (i = 0; i < size; i++) {
+        row = solver_push_row(self);
+        for (k = 0; k < 2; k++) {
+            if (bytes[k] != NULL) {
+                if ((bytes[k][i / 8] >> (i % 8)) & 1)
+                    solver_flip_rhs(self, row);
+                continue;
+            }
+            vec = (BitVecObject *)sides[k];
+            if (i < Py_SIZE(vec))
+                row_xor_bitvec(self, row, vec, i);
+        }
+        solver_pop_if_trivial(self, row);
+    }
+    result = 0;
+
+done:
+    PyMem_Free(bytes[0]);
+    PyMem_Free(bytes[1]);
+    return result;
+}
+
+/* Falls back on the zeros() protocol for constraint-like objects of other types. */
+static int
+solver_add_zeros(SolverObject *self, PyObject *constraint)
+{
+    PyObject *zeros, *seq, **items;
+    Py_ssize_t size, i;
+
+    zeros = PyObject_CallMethod(constraint, "zeros", NULL);
+    if (zeros == NULL)
+        return -1;
+    seq = PySequence_Fast(zeros, "zeros() must return an iterable");
+    Py_DECREF(zeros);
+    if (seq == NULL)
+        return -1;
+
+    size = PySequence_Fast_GET_SIZE(seq);
+    items = PySequence_Fast_ITEMS(seq);
+    for (i = 0; i < size; i++) {
+        if (!BitExpr_Check(items[i])) {
+            PyErr_Format(PyExc_TypeError,
+                "expected iterable of BitExprs, got: '%.200s'",
+                Py_TYPE(items[i])->tp_name);
+            goto error;
+        }
+        if (solver_add_bitexpr_pair(self, items[i], NULL) < 0)
+            goto error;
+    }
+    Py_DECREF(seq);
+    return 0;
+
+error:
+    Py_DECREF(seq);
+    return -1;
+}
+
+static PyObject *
+solver_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    SolverObject *self;
+
+    if (!_PyArg_NoKeywords(type->tp_name, kwds))
+        return NULL;
+    if (!PyArg_UnpackTuple(args, type->tp_name, 0, 0))
+        return NULL;
+
+    self = (SolverObject *)type->tp_alloc(type, 0);
+    if (self == NULL)
+        return NULL;
+    self->system = NULL;
+    self->rows = NULL;
+    self->pivots = NULL;
+    self->nrows = 0;
+    self->rank = 0;
+    self->inconsistent = 0;
+    self->checkpoints = NULL;
+    self->ncheckpoints = 0;
+    self->undo = NULL;
+    self->undo_rows = NULL;
+    self->nundo = 0;
+    self->saved = NULL;
+    self->epoch = 0;
+    self->busy = 0;
+    self->cancelled = 0;
+    return (PyObject *)self;
+}
+
+static PyObject *
+solver_add(SolverObject *self, PyObject *args)
+{
+    ConstraintObject *c;
+    PyObject *arg;
+    Py_ssize_t i;
+    int err;
+
+    if (solver_check_busy(self) < 0)
+        return NULL;
+    for (i = 0; i < PyTuple_GET_SIZE(args); i++) {
+        arg = PyTuple_GET_ITEM(args, i);
+        if (PyObject_TypeCheck(arg, &BitVecConstraint_Type)) {
+            c = (ConstraintObject *)arg;
+            err = solver_add_bitvec_pair(self, c->lhs, c->rhs);
+        } else if (PyObject_TypeCheck(arg, &Constraint_Type)) {
+            c = (ConstraintObject *)arg;
+            err = solver_add_bitexpr_pair(self, c->lhs, c->rhs);
+        } else {
+            err = solver_add_zeros(self, arg);
+        }
+        if (err < 0)
+            return NULL;
+    }
+    if (solver_maybe_flush(self) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+solver_add_matrix(SolverObject *self, PyObject *args)
+{
+    LinearSystemObject *system;
+    PyObject *aobj, *bobj;
+    Py_buffer a, b;
+    Py_ssize_t rows, rowbytes, i;
+    const char *src;
+    word *row;
+    rci_t cols;
+    int rhs;
+
+    if (!PyArg_ParseTuple(args, "OOO!", &aobj, &bobj, &LinearSystem_Type, &system))
+        return NULL;
+    if (solver_check_busy(self) < 0 || solver_bind(self, (PyObject *)system) < 0)
+        return NULL;
+    if (PyObject_GetBuffer(aobj, &a, PyBUF_RECORDS_RO) < 0)
+        return NULL;
+    if (PyObject_GetBuffer(bobj, &b, PyBUF_RECORDS_RO) < 0) {
+        PyBuffer_Release(&a);
+        return NULL;
+    }
+    cols = (rci_t)system->bits;
+
+    // A holds one packed row per equation, as uint8 or uint64 items in little-endian
+    // bit order, exactly as many items as needed to cover the system's bits.
+    if (a.ndim != 2 || (a.itemsize != 1 && a.itemsize != 8) ||
+            a.strides[1] != a.itemsize) {
+        PyErr_SetString(PyExc_ValueError,
+            "A must be a 2-D array of uint8 or uint64 with contiguous rows");
+        goto error;
+    }
+    rowbytes = a.shape[1] * a.itemsize;
+    if (a.shape[1] != (cols + 8 * a.itemsize - 1) / (8 * a.itemsize)) {
+        PyErr_Format(PyExc_ValueError,
+            "A must have %zd items per row for a system with %d bits",
+            (cols + 8 * a.itemsize - 1) / (8 * a.itemsize), cols);
+        goto error;
+    }
+    if (b.ndim != 1 || b.shape[0] != a.shape[0] ||
+            (b.itemsize != 1 && b.itemsize != 2 && b.itemsize != 4 && b.itemsize != 8)) {
+        PyErr_SetString(PyExc_ValueError,
+            "b must be a 1-D array of integers with one entry per row of A");
+        goto error;
+    }
+
+    rows = a.shape[0];
+    if (solver_reserve(self, rows) < 0)
+        goto error;
+
+    // Copy the rows straight into the store
+    for (i = 0; i < rows; i++) {
+        row = solver_push_row(self);
+        memcpy(row, (const char *)a.buf + i * a.strides[0], rowbytes);
+        if (cols % m4ri_radix != 0 && (row[cols / m4ri_radix] >> (cols % m4ri_radix))) {
+            PyErr_Format(PyExc_ValueError,
+                "row %zd of A has bits set past the last variable", i);
+            self->nrows -= i + 1;
+            goto error;
+        }
+
+        src = (const char *)b.buf + i * b.strides[0];
+        switch (b.itemsize) {
+        case 1: rhs = *(const uint8_t *)src != 0; break;
+        case 2: rhs = *(const uint16_t *)src != 0; break;
+        case 4: rhs = *(const uint32_t *)src != 0; break;
+        default: rhs = *(const uint64_t *)src != 0; break;
+        }
+        if (rhs)
+            solver_flip_rhs(self, row);
+    }
+
+    PyBuffer_Release(&a);
+    PyBuffer_Release(&b);
+    if (solver_maybe_flush(self) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+
+error:
+    PyBuffer_Release(&a);
+    PyBuffer_Release(&b);
+    return NULL;
+}
+
+static PyObject *
+solver_solve(SolverObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "all", "format", "threads", NULL };
+    model_format_t format = MODEL_DICT;
+    PyObject *result;
+    mzd_t *M;
+    int all = 0, threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|p$O&O&", kwlist, &all,
+                                     model_format_converter, &format,
+                                     threads_converter, &threads))
+        return NULL;
+    if (solver_check_busy(self) < 0)
+        return NULL;
+    if (self->system == NULL) {
+        PyErr_SetString(PyExc_ValueError, "solver does not contain any equations");
+        return NULL;
+    }
+
+    // Until something is merged, the pending rows are the whole system and get the same
+    // presolve and per-component elimination as solve_zeros(). They are solved from a
+    // copy, so the solver can still be extended afterwards. A merge that only turned up
+    // a contradiction leaves the rank at 0 too, so check for that first.
+    if (self->rank == 0 && self->nrows > 0 && !self->inconsistent &&
+        self->rows->ncols - 1 > SMALL_MAX_COLS) {
+        M = mzd_submatrix(NULL, self->rows, 0, 0, self->nrows, self->rows->ncols);
+        __atomic_store_n(&self->cancelled, 0, __ATOMIC_RELAXED);
+        self->busy = 1;
+        result = solve_matrix((LinearSystemObject *)self->system, M, all, format, threads);
+        self->busy = 0;
+        mzd_free(M);
+        if (result != NULL && __atomic_exchange_n(&self->cancelled, 0, __ATOMIC_RELAXED)) {
+            Py_DECREF(result);
+            PyErr_SetString(PyExc_RuntimeError, "solve was cancelled");
+            return NULL;
+        }
+        return result;
+    }
+
+    if (solver_flush(self, threads) < 0)
+        return NULL;
+    if (self->inconsistent) {
+        PyErr_SetString(PyExc_ValueError, "no solution");
+        return NULL;
+    }
+    self->busy = 1;
+    result = solve_echelon((LinearSystemObject *)self->system, self->rows, self->rank,
+                           all, format, threads);
+    self->busy = 0;
+    return result;
+}
+
+static PyObject *
+solver_push(SolverObject *self, PyObject *Py_UNUSED(ignored))
+{
+    solver_checkpoint_t *checkpoints, *cp;
+
+    if (self->system != NULL && solver_flush(self, 0) < 0)
+        return NULL;
+
+    checkpoints = PyMem_Resize(self->checkpoints, solver_checkpoint_t,
+                               self->ncheckpoints + 1);
+    if (checkpoints == NULL)
+        return PyErr_NoMemory();
+    self->checkpoints = checkpoints;
+
+    cp = &checkpoints[self->ncheckpoints++];
+    cp->rank = self->rank;
+    cp->undo = self->nundo;
+    cp->epoch = ++self->epoch;
+    cp->inconsistent = self->inconsistent;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+solver_pop(SolverObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    solver_checkpoint_t *cp;
+    Py_ssize_t n = 1, i;
+
+    if (!_PyArg_CheckPositional("pop", nargs, 0, 1))
+        return NULL;
+    if (solver_check_busy(self) < 0)
+        return NULL;
+    if (nargs == 1) {
+        n = PyLong_AsSsize_t(args[0]);
+        if (n == -1 && PyErr_Occurred())
+            return NULL;
+        if (n < 0) {
+            PyErr_SetString(PyExc_ValueError, "number of checkpoints must be non-negative");
+            return NULL;
+        }
+    }
+    if (n > self->ncheckpoints) {
+        PyErr_SetString(PyExc_IndexError, "pop without a matching push");
+        return NULL;
+    }
+
+    for (; n > 0; n--) {
+        cp = &self->checkpoints[--self->ncheckpoints];
+        // Put back the basis rows touched since the push, newest first
+        for (i = self->nundo - 1; i >= cp->undo; i--)
+            memcpy(mzd_row(self->rows, self->undo_rows[i]), mzd_row(self->undo, (rci_t)i),
+                   self->undo->width * sizeof(word));
+        self->nundo = cp->undo;
+        self->rank = cp->rank;
+        self->nrows = cp->rank;
+        self->inconsistent = cp->inconsistent;
+    }
+    Py_RETURN_NONE;
+}
+
+/* Asks an elimination running in another thread to stop after its current block. The
+   rows that were not merged yet stay pending. */
+static PyObject *
+solver_cancel(SolverObject *self, PyObject *Py_UNUSED(ignored))
+{
+    if (self->busy)
+        __atomic_store_n(&self->cancelled, 1, __ATOMIC_RELAXED);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+solver_get_num_checkpoints(SolverObject *self, void *closure)
+{
+    return PyLong_FromSsize_t(self->ncheckpoints);
+}
+
+static PyObject *
+solver_get_rank(SolverObject *self, void *closure)
+{
+    if (self->system != NULL && solver_flush(self, 0) < 0)
+        return NULL;
+    return PyLong_FromLong(self->rank);
+}
+
+static PyObject *
+solver_get_is_consistent(SolverObject *self, void *closure)
+{
+    if (self->system != NULL && solver_flush(self, 0) < 0)
+        return NULL;
+    return PyBool_FromLong(!self->inconsistent);
+}
+
+static PyObject *
+solver_get_is_determined(SolverObject *self, void *closure)
+{
+    if (self->system == NULL)
+        Py_RETURN_FALSE;
+    if (solver_flush(self, 0) < 0)
+        return NULL;
+    return PyBool_FromLong(!self->inconsistent &&
+                           self->rank == ((LinearSystemObject *)self->system)->bits);
+}
+
+static void
+solver_dealloc(SolverObject *self)
+{
+    Py_XDECREF(self->system);
+    mzd_xfree(self->rows);
+    PyMem_Free(self->pivots);
+    PyMem_Free(self->checkpoints);
+    mzd_xfree(self->undo);
+    PyMem_Free(self->undo_rows);
+    PyMem_Free(self->saved);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyMethodDef solver_methods[] = {
+    { "add", (PyCFunction)solver_add, METH_VARARGS, NULL },
+    { "add_matrix", (PyCFunction)solver_add_matrix, METH_VARARGS, NULL },
+    { "solve", (PyCFunction)solver_solve, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "push", (PyCFunction)solver_push, METH_NOARGS, NULL },
+    { "pop", (_PyCFunctionFast)solver_pop, METH_FASTCALL, NULL },
+    { "cancel", (PyCFunction)solver_cancel, METH_NOARGS, NULL },
+    { NULL },
+};
+
+static PyMemberDef solver_members[] = {
+    { "system", T_OBJECT, offsetof(SolverObject, system), READONLY, NULL },
+    { NULL },
+};
+
+static PyGetSetDef solver_getset[] = {
+    { "rank", (getter)solver_get_rank, NULL, NULL, NULL },
+    { "is_consistent", (getter)solver_get_is_consistent, NULL, NULL, NULL },
+    { "is_determined", (getter)solver_get_is_determined, NULL, NULL, NULL },
+    { "num_checkpoints", (getter)solver_get_num_checkpoints, NULL, NULL, NULL },
+    { NULL },
+};
+
+static PyTypeObject Solver_Type = {
+    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "xorsat.Solver",
+    .tp_basicsize = sizeof(SolverObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)solver_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .tp_doc = NULL,
+    .tp_methods = solver_methods,
+    .tp_members = solver_members,
+    .tp_getset = solver_getset,
+    .tp_new = solver_new,
+};
+
+/* ============================= Factorization ============================== */
+
+static PyObject *
+factorization_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "exprs", "threads", NULL };
+    FactorizationObject *self;
+    LinearSystemObject *system;
+    BitExprObject *expr;
+    BitSetObject *mask;
+    PyObject *arg, *seq, **items;
+    Py_ssize_t size, i;
+    rci_t cols, lc, r;
+    mzd_t *W, *T;
+    int threads = 0, prev;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|$O&", kwlist, &arg,
+                                     threads_converter, &threads))
+        return NULL;
+
+    seq = PySequence_Fast(arg, "argument is not iterable");
+    if (seq == NULL)
+        return NULL;
+
+    size = PySequence_Fast_GET_SIZE(seq);
+    if (size == 0) {
+        PyErr_SetString(PyExc_ValueError, "iterable cannot be empty");
+        goto error;
+    }
+    if (size >= INT_MAX / 2) {
+        PyErr_SetString(PyExc_OverflowError, "number of equations must be <2^30");
+        goto error;
+    }
+
+    items = PySequence_Fast_ITEMS(seq);
+    for (i = 0; i < size; i++) {
+        if (!BitExpr_Check(items[i])) {
+            PyErr_Format(PyExc_TypeError,
+                "expected iterable of BitExprs, got: '%.200s'",
+                Py_TYPE(items[i])->tp_name);
+            goto error;
+        }
+        if (!Py_Is(((BitExprObject *)items[i])->system,
+                   ((BitExprObject *)items[0])->system)) {
+            PyErr_SetString(PyExc_TypeError,
+                "iterable cannot contain differing linear systems");
+            goto error;
+        }
+    }
+
+    system = (LinearSystemObject *)((BitExprObject *)items[0])->system;
+    if (system->bits >= INT_MAX / 2) {
+        PyErr_SetString(PyExc_OverflowError, "number of bits in system must be <2^30");
+        goto error;
+    }
+
+    self = (FactorizationObject *)type->tp_alloc(type, 0);
+    if (self == NULL)
+        goto error;
+    cols = (rci_t)system->bits;
+    self->system = Py_NewRef(system);
+    self->nrows = (rci_t)size;
+    self->offset = mzd_init(1, (rci_t)size);
+    self->kernel = NULL;
+
+    // Echelonize [A | I] in full. The identity block, which starts on a word boundary,
+    // records the row operations, so that its left part becomes T with T * A = [R; 0].
+    lc = (cols + m4ri_radix - 1) / m4ri_radix * m4ri_radix;
+    W = mzd_init((rci_t)size, lc + (rci_t)size);
+    for (i = 0; i < size; i++) {
+        expr = (BitExprObject *)items[i];
+        mask = (BitSetObject *)expr->mask;
+        bitset_xor_into(mask, mzd_row(W, i));
+        mzd_write_bit(W, i, lc + i, 1);
+        if (expr->compl)
+            mzd_write_bit(self->offset, 0, i, 1);
+    }
+    // Every row has a pivot, but only the first rank of them lead inside A
+    Py_BEGIN_ALLOW_THREADS
+    prev = set_num_threads(threads);
+    mzd_echelonize(W, 1);
+    set_num_threads(prev);
+    for (r = 0; r < (rci_t)size && mzd_row_lead(W, r) < cols; r++)
+        ;
+    Py_END_ALLOW_THREADS
+    self->rank = r;
+
+    self->R = mzd_submatrix(NULL, W, 0, 0, self->rank, cols);
+    self->pivots = (rci_t *)PyMem_Malloc((self->rank + 1) * sizeof(rci_t));
+    if (self->pivots == NULL) {
+        mzd_free(W);
+        Py_DECREF(self);
+        PyErr_NoMemory();
+        goto error;
+    }
+    for (r = 0; r < self->rank; r++)
+        self->pivots[r] = mzd_row_lead(self->R, r);
+
+    T = mzd_submatrix(NULL, W, 0, lc, (rci_t)size, lc + (rci_t)size);
+    self->Tt = mzd_transpose(NULL, T);
+    mzd_free(T);
+    mzd_free(W);
+
+    Py_DECREF(seq);
+    return (PyObject *)self;
+
+error:
+    Py_DECREF(seq);
+    return NULL;
+}
+
+/* Solves every row of B (k x nrows, one right-hand side per row) at once. Row j of the
+   returned matrix holds the solution to right-hand side j with the free variables set
+   to 0, and consistent[j] is cleared if it has none. B is overwritten. Safe to call
+   without the GIL. */
+static mzd_t *
+factorization_apply(FactorizationObject *self, mzd_t *B, uint8_t *consistent)
+{
+    mzd_t *Y, *X;
+    rci_t j, r;
+
+    for (j = 0; j < B->nrows; j++)
+        mzd_combine_even_in_place(B, j, 0, self->offset, 0, 0);
+
+    // Row j of Y is T * b_j: the first rank entries are the pivot variables, and the
+    // rest must vanish for b_j to be in the column space of A.
+    Y = mzd_mul(NULL, B, self->Tt, 0);
+    X = mzd_init(B->nrows, self->R->ncols);
+    for (j = 0; j < B->nrows; j++) {
+        consistent[j] = 1;
+        for (r = self->rank; r < self->nrows; r++) {
+            if (mzd_read_bit(Y, j, r)) {
+                consistent[j] = 0;
+                break;
+            }
+        }
+        if (!consistent[j])
+            continue;
+        for (r = 0; r < self->rank; r++)
+            if (mzd_read_bit(Y, j, r))
+                mzd_write_bit(X, j, self->pivots[r], 1);
+    }
+    mzd_free(Y);
+    return X;
+}
+
+static PyObject *
+factorization_solve(FactorizationObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "rhs", "all", "format", NULL };
+    model_format_t format = MODEL_DICT;
+    PyObject *rhs, *result;
+    Py_ssize_t n;
+    uint8_t consistent;
+    mzd_t *B, *X, *kernel;
+    int all = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|p$O&", kwlist, &PyLong_Type, &rhs,
+                                     &all, model_format_converter, &format))
+        return NULL;
+
+    // Bit i of rhs is the right-hand side of equation i
+    if (Py_SIZE(rhs) < 0) {
+        PyErr_SetString(PyExc_ValueError, "rhs must be non-negative");
+        return NULL;
+    }
+    if (_PyLong_NumBits(rhs) > (size_t)self->nrows) {
+        PyErr_SetString(PyExc_ValueError, "rhs has bits set past the last equation");
+        return NULL;
+    }
+    B = mzd_init(1, self->nrows);
+    n = (self->nrows + 7) / 8;
+    if (_PyLong_AsByteArray((PyLongObject *)rhs, (unsigned char *)mzd_row(B, 0), n,
+                            PY_LITTLE_ENDIAN, 0) < 0) {
+        mzd_free(B);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    X = factorization_apply(self, B, &consistent);
+    Py_END_ALLOW_THREADS
+    mzd_free(B);
+    if (!consistent) {
+        PyErr_SetString(PyExc_ValueError, "no solution");
+        mzd_free(X);
+        return NULL;
+    }
+    if (!all) {
+        result = generate_model(X, (LinearSystemObject *)self->system, format);
+        mzd_free(X);
+        return result;
+    }
+
+    if (self->kernel == NULL) {
+        Py_BEGIN_ALLOW_THREADS
+        kernel = echelon_kernel(self->R, self->rank, self->R->ncols);
+        Py_END_ALLOW_THREADS
+        // Another thread may have got there first
+        if (self->kernel == NULL)
+            self->kernel = kernel;
+        else
+            mzd_free(kernel);
+    }
+    return solveiter_create((LinearSystemObject *)self->system, X,
+                            mzd_copy(NULL, self->kernel), format);
+}
+
+static PyObject *
+factorization_solve_many(FactorizationObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "rhs", "format", NULL };
+    model_format_t format = MODEL_DICT;
+    PyObject *obj, *result = NULL, *model;
+    Py_buffer b;
+    Py_ssize_t k, rowbytes, i;
+    uint8_t *consistent = NULL;
+    mzd_t *B, *X = NULL, *x;
+    rci_t m = self->nrows;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|$O&", kwlist, &obj,
+                                     model_format_converter, &format))
+        return NULL;
+    if (PyObject_GetBuffer(obj, &b, PyBUF_RECORDS_RO) < 0)
+        return NULL;
+
+    // One packed row of right-hand sides per target, laid out like the rows of
+    // Solver.add_matrix(); a BitMatrix with one column per equation also fits.
+    if (b.ndim != 2 || (b.itemsize != 1 && b.itemsize != 8) ||
+            b.strides[1] != b.itemsize) {
+        PyErr_SetString(PyExc_ValueError,
+            "rhs must be a 2-D array of uint8 or uint64 with contiguous rows");
+        goto done;
+    }
+    if (b.shape[1] != (m + 8 * b.itemsize - 1) / (8 * b.itemsize)) {
+        PyErr_Format(PyExc_ValueError,
+            "rhs must have %zd items per row for %d equations",
+            (m + 8 * b.itemsize - 1) / (8 * b.itemsize), m);
+        goto done;
+    }
+    k = b.shape[0];
+    if (k >= INT_MAX) {
+        PyErr_SetString(PyExc_OverflowError, "number of right-hand sides must be <2^31");
+        goto done;
+    }
+
+    rowbytes = b.shape[1] * b.itemsize;
+    B = mzd_init((rci_t)k, m);
+    for (i = 0; i < k; i++) {
+        memcpy(mzd_row(B, i), (const char *)b.buf + i * b.strides[0], rowbytes);
+        if (m % m4ri_radix != 0 && (mzd_row(B, i)[m / m4ri_radix] >> (m % m4ri_radix))) {
+            PyErr_Format(PyExc_ValueError,
+                "row %zd of rhs has bits set past the last equation", i);
+            mzd_free(B);
+            goto done;
+        }
+    }
+
+    consistent = (uint8_t *)PyMem_Malloc(k + 1);
+    if (consistent == NULL) {
+        PyErr_NoMemory();
+        mzd_free(B);
+        goto done;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    X = factorization_apply(self, B, consistent);
+    Py_END_ALLOW_THREADS
+    mzd_free(B);
+
+    result = PyList_New(k);
+    if (result == NULL)
+        goto done;
+    for (i = 0; i < k; i++) {
+        if (!consistent[i]) {
+            PyList_SET_ITEM(result, i, Py_NewRef(Py_None));
+            continue;
+        }
+        x = mzd_init_window(X, (rci_t)i, 0, (rci_t)i + 1, X->ncols);
+        model = generate_model(x, (LinearSystemObject *)self->system, format);
+        mzd_free_window(x);
+        if (model == NULL) {
+            Py_CLEAR(result);
+            goto done;
+        }
+        PyList_SET_ITEM(result, i, model);
+    }
+
+done:
+    mzd_xfree(X);
+    PyMem_Free(consistent);
+    PyBuffer_Release(&b);
+    return result;
+}
+
+static PyObject *
+factorization_repr(FactorizationObject *self)
+{
+    return PyUnicode_FromFormat("<Factorization %dx%zd, rank %d>", self->nrows,
+                                ((LinearSystemObject *)self->system)->bits, self->rank);
+}
+
+static void
+factorization_dealloc(FactorizationObject *self)
+{
+    Py_XDECREF(self->system);
+    mzd_xfree(self->R);
+    mzd_xfree(self->Tt);
+    mzd_xfree(self->offset);
+    mzd_xfree(self->kernel);
+    PyMem_Free(self->pivots);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyMethodDef factorization_methods[] = {
+    { "solve", (PyCFunction)factorization_solve, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "solve_many", (PyCFunction)factorization_solve_many, METH_VARARGS | METH_KEYWORDS,
+      NULL },
+    { NULL },
+};
+
+static PyMemberDef factorization_members[] = {
+    { "system", T_OBJECT, offsetof(FactorizationObject, system), READONLY, NULL },
+    { "nrows", T_INT, offsetof(FactorizationObject, nrows), READONLY, NULL },
+    { "rank", T_INT, offsetof(FactorizationObject, rank), READONLY, NULL },
+    { NULL },
+};
+
+static PyTypeObject Factorization_Type = {
+    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "xorsat.Factorization",
+    .tp_basicsize = sizeof(FactorizationObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)factorization_dealloc,
+    .tp_repr = (reprfunc)factorization_repr,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = NULL,
+    .tp_methods = factorization_methods,
+    .tp_members = factorization_members,
+    .tp_new = factorization_new,
+};
+
+/* =============================== LinearMap ================================ */
+
+/* A LinearMap is an affine map x -> A*x + c between bit vectors. It is recorded once by
+   running a function on a symbolic input, after which applying it to a BitVec is a
+   single matrix product on the packed rows of the vector. */
+
+static LinearMapObject *
+linearmap_alloc(PyTypeObject *type, mzd_t *A, mzd_t *c)
+{
+    LinearMapObject *self;
+
+    self = (LinearMapObject *)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        mzd_free(A);
+        mzd_free(c);
+        return NULL;
+    }
+    self->A = A;
+    self->c = c;
+    return self;
+}
+
+static PyObject *
+linearmap_trace(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "fn", "width", NULL };
+    LinearSystemObject *system = NULL;
+    BitVecObject *x = NULL, *y = NULL;
+    PyObject *fn, *result = NULL, *tmp;
+    Py_ssize_t width, col, i;
+    mzd_t *A, *c;
+    word *row;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "On:trace", kwlist, &fn, &width))
+        return NULL;
+    if (width <= 0) {
+        PyErr_SetString(PyExc_ValueError, "width must be positive");
+        return NULL;
+    }
+
+    // Run fn on a fresh variable of the given width
+    tmp = Py_BuildValue("{s:n}", "x", width);
+    if (tmp == NULL)
+        return NULL;
+    system = (LinearSystemObject *)PyObject_VectorcallDict((PyObject *)&LinearSystem_Type,
+                                                           NULL, 0, tmp);
+    Py_DECREF(tmp);
+    if (system == NULL)
+        return NULL;
+    x = (BitVecObject *)linearsystem_gen_packed(system, 0);
+    if (x == NULL)
+        goto done;
+    tmp = PyObject_CallOneArg(fn, (PyObject *)x);
+    if (tmp == NULL)
+        goto done;
+    if (!BitVec_Check(tmp) || !Py_Is(((BitVecObject *)tmp)->system, (PyObject *)system)) {
+        PyErr_SetString(PyExc_TypeError,
+            "traced function must return a BitVec computed from its argument");
+        Py_DECREF(tmp);
+        goto done;
+    }
+    y = (BitVecObject *)bitvec_pack_impl((BitVecObject *)tmp);
+    Py_DECREF(tmp);
+    if (y == NULL)
+        goto done;
+
+    // Row i of y is (row i of A | c_i)
+    A = mzd_init((rci_t)Py_SIZE(y), (rci_t)width);
+    c = mzd_init((rci_t)Py_SIZE(y), 1);
+    col = BV_CONST_COL(width);
+    for (i = 0; i < Py_SIZE(y); i++) {
+        row = mzd_row(y->M, i);
+        memcpy(mzd_row(A, i), row, A->width * sizeof(word));
+        mzd_write_bit(c, i, 0, (row[col / m4ri_radix] >> (col % m4ri_radix)) & 1);
+    }
+    result = (PyObject *)linearmap_alloc(type, A, c);
+
+done:
+    Py_XDECREF(y);
+    Py_XDECREF(x);
+    Py_DECREF(system);
+    return result;
+}
+
+static PyObject *
+linearmap_apply_bitvec(LinearMapObject *self, BitVecObject *vec)
+{
+    BitVecObject *x, *result;
+    Py_ssize_t i;
+    mzd_t *Y;
+
+    if (Py_SIZE(vec) != self->A->ncols) {
+        PyErr_Format(PyExc_ValueError, "expected a BitVec of width %d, got %zd",
+                     self->A->ncols, Py_SIZE(vec));
+        return NULL;
+    }
+    x = (BitVecObject *)bitvec_pack_impl(vec);
+    if (x == NULL)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    Y = mzd_mul(NULL, self->A, x->M, 0);
+    for (i = 0; i < self->A->nrows; i++) {
+        if (mzd_read_bit(self->c, i, 0))
+            bitvec_flip_const(x, mzd_row(Y, i));
+    }
+    Py_END_ALLOW_THREADS
+
+    result = (BitVecObject *)bitvec_from_size(&BitVec_Type, self->A->nrows, x->system, 0);
+    Py_DECREF(x);
+    if (result == NULL) {
+        mzd_free(Y);
+        return NULL;
+    }
+    result->M = Y;
+    return (PyObject *)result;
+}
+
+static PyObject *
+linearmap_apply_int(LinearMapObject *self, PyObject *num)
+{
+    PyObject *result = NULL;
+    uint8_t *buf;
+    Py_ssize_t n, i;
+    mzd_t *X, *Y;
+
+    n = (Py_MAX(self->A->ncols, self->A->nrows) + 7) / 8;
+    buf = (uint8_t *)PyMem_Calloc(n, 1);
+    if (buf == NULL)
+        return PyErr_NoMemory();
+    if (_PyLong_AsByteArray((PyLongObject *)num, buf, (self->A->ncols + 7) / 8,
+                            PY_LITTLE_ENDIAN, 0) < 0)
+        goto done;
+
+    X = mzd_init(self->A->ncols, 1);
+    for (i = 0; i < self->A->ncols; i++)
+        mzd_write_bit(X, i, 0, (buf[i / 8] >> (i % 8)) & 1);
+    Y = mzd_mul(NULL, self->A, X, 0);
+    memset(buf, 0, n);
+    for (i = 0; i < self->A->nrows; i++) {
+        if (mzd_read_bit(Y, i, 0) ^ mzd_read_bit(self->c, i, 0))
+            buf[i / 8] |= 1 << (i % 8);
+    }
+    mzd_free(X);
+    mzd_free(Y);
+    result = _PyLong_FromByteArray(buf, (self->A->nrows + 7) / 8, 1, 0);
+
+done:
+    PyMem_Free(buf);
+    return result;
+}
+
+static PyObject *
+linearmap_call(LinearMapObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *arg;
+
+    if (!_PyArg_NoKeywords("LinearMap", kwds))
+        return NULL;
+    if (!PyArg_UnpackTuple(args, "LinearMap", 1, 1, &arg))
+        return NULL;
+
+    if (BitVec_Check(arg))
+        return linearmap_apply_bitvec(self, (BitVecObject *)arg);
+    if (PyLong_Check(arg))
+        return linearmap_apply_int(self, arg);
+    PyErr_Format(PyExc_TypeError, "expected BitVec or int, got: '%.200s'",
+                 Py_TYPE(arg)->tp_name);
+    return NULL;
+}
+
+/* Returns f after g, x -> A1*(A2*x + c2) + c1. The widths must match. */
+static LinearMapObject *
+linearmap_compose_impl(LinearMapObject *f, LinearMapObject *g)
+{
+    mzd_t *A, *c;
+
+    Py_BEGIN_ALLOW_THREADS
+    A = mzd_mul(NULL, f->A, g->A, 0);
+    c = mzd_mul(NULL, f->A, g->c, 0);
+    mzd_add(c, c, f->c);
+    Py_END_ALLOW_THREADS
+
+    return linearmap_alloc(Py_TYPE(f), A, c);
+}
+
+static PyObject *
+linearmap_compose(LinearMapObject *self, PyObject *other)
+{
+    LinearMapObject *g;
+
+    if (!PyObject_TypeCheck(other, &LinearMap_Type)) {
+        PyErr_Format(PyExc_TypeError, "expected LinearMap, got: '%.200s'",
+                     Py_TYPE(other)->tp_name);
+        return NULL;
+    }
+    g = (LinearMapObject *)other;
+    if (g->A->nrows != self->A->ncols) {
+        PyErr_Format(PyExc_ValueError, "cannot compose a map from width %d after one to "
+                     "width %d", self->A->ncols, g->A->nrows);
+        return NULL;
+    }
+    return (PyObject *)linearmap_compose_impl(self, g);
+}
+
+static PyObject *
+linearmap_matmul(PyObject *a, PyObject *b)
+{
+    if (!PyObject_TypeCheck(a, &LinearMap_Type) || !PyObject_TypeCheck(b, &LinearMap_Type))
+        Py_RETURN_NOTIMPLEMENTED;
+    return linearmap_compose((LinearMapObject *)a, b);
+}
+
+/* Raises a map to the n-th power by repeated squaring, so that jumping n steps ahead
+   costs O(log n) matrix products. */
+static PyObject *
+linearmap_power(PyObject *a, PyObject *b, PyObject *mod)
+{
+    LinearMapObject *self, *result, *base, *tmp;
+    unsigned long long n;
+    mzd_t *A, *c;
+
+    if (!PyObject_TypeCheck(a, &LinearMap_Type) || !PyLong_Check(b))
+        Py_RETURN_NOTIMPLEMENTED;
+    if (mod != Py_None) {
+        PyErr_SetString(PyExc_TypeError, "pow() 3rd argument not allowed for LinearMap");
+        return NULL;
+    }
+    self = (LinearMapObject *)a;
+    if (self->A->nrows != self->A->ncols) {
+        PyErr_SetString(PyExc_ValueError, "only maps of equal input and output width "
+                        "can be raised to a power");
+        return NULL;
+    }
+    if (Py_SIZE(b) < 0) {
+        PyErr_SetString(PyExc_ValueError, "negative power");
+        return NULL;
+    }
+    n = PyLong_AsUnsignedLongLong(b);
+    if (n == (unsigned long long)-1 && PyErr_Occurred())
+        return NULL;
+
+    A = mzd_init(self->A->nrows, self->A->ncols);
+    mzd_set_ui(A, 1);
+    c = mzd_init(self->A->nrows, 1);
+    result = linearmap_alloc(Py_TYPE(self), A, c);
+    if (result == NULL)
+        return NULL;
+
+    base = (LinearMapObject *)Py_NewRef(self);
+    while (n != 0) {
+        if (n & 1) {
+            tmp = linearmap_compose_impl(base, result);
+            Py_SETREF(result, tmp);
+            if (result == NULL)
+                break;
+        }
+        n >>= 1;
+        if (n != 0) {
+            tmp = linearmap_compose_impl(base, base);
+            Py_SETREF(base, tmp);
+            if (base == NULL) {
+                Py_CLEAR(result);
+                break;
+            }
+        }
+    }
+    Py_XDECREF(base);
+    return (PyObject *)result;
+}
+
+static PyObject *
+linearmap_get_matrix(LinearMapObject *self, void *closure)
+{
+    return bitmatrix_create(&BitMatrix_Type, mzd_copy(NULL, self->A));
+}
+
+static PyObject *
+linearmap_get_offset(LinearMapObject *self, void *closure)
+{
+    PyObject *result;
+    uint8_t *buf;
+    rci_t i;
+
+    buf = (uint8_t *)PyMem_Calloc((self->c->nrows + 7) / 8, 1);
+    if (buf == NULL)
+        return PyErr_NoMemory();
+    for (i = 0; i < self->c->nrows; i++) {
+        if (mzd_read_bit(self->c, i, 0))
+            buf[i / 8] |= 1 << (i % 8);
+    }
+    result = _PyLong_FromByteArray(buf, (self->c->nrows + 7) / 8, 1, 0);
+    PyMem_Free(buf);
+    return result;
+}
+
+static PyObject *
+linearmap_get_in_width(LinearMapObject *self, void *closure)
+{
+    return PyLong_FromLong(self->A->ncols);
+}
+
+static PyObject *
+linearmap_get_out_width(LinearMapObject *self, void *closure)
+{
+    return PyLong_FromLong(self->A->nrows);
+}
+
+static PyObject *
+linearmap_repr(LinearMapObject *self)
+{
+    return PyUnicode_FromFormat("<LinearMap %d -> %d>", self->A->ncols, self->A->nrows);
+}
+
+static void
+linearmap_dealloc(LinearMapObject *self)
+{
+    mzd_xfree(self->A);
+    mzd_xfree(self->c);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyNumberMethods linearmap_as_number = {
+    .nb_power = (ternaryfunc)linearmap_power,
+    .nb_matrix_multiply = (binaryfunc)linearmap_matmul,
+};
+
+static PyMethodDef linearmap_methods[] = {
+    { "trace", (PyCFunction)linearmap_trace, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+      NULL },
+    { "compose", (PyCFunction)linearmap_compose, METH_O, NULL },
+    { NULL },
+};
+
+static PyGetSetDef linearmap_getset[] = {
+    { "matrix", (getter)linearmap_get_matrix, NULL, NULL, NULL },
+    { "offset", (getter)linearmap_get_offset, NULL, NULL, NULL },
+    { "in_width", (getter)linearmap_get_in_width, NULL, NULL, NULL },
+    { "out_width", (getter)linearmap_get_out_width, NULL, NULL, NULL },
+    { NULL },
+};
+
+static PyTypeObject LinearMap_Type = {
+    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "xorsat.LinearMap",
+    .tp_basicsize = sizeof(LinearMapObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)linearmap_dealloc,
+    .tp_repr = (reprfunc)linearmap_repr,
+    .tp_as_number = &linearmap_as_number,
+    .tp_call = (ternaryfunc)linearmap_call,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = NULL,
+    .tp_methods = linearmap_methods,
+    .tp_getset = linearmap_getset,
+};
+
+/* ================================ MTEngine ================================ */
+
+/* A symbolic Mersenne Twister that writes the equations for observed outputs straight
+   into a Solver. It mirrors xorsat.crypto.MersenneTwister: the state is twisted one word
+   at a time, right before that word is output. */
+
+static uint64_t
+mtengine_temper_int(uint64_t y, uint64_t w1, int u, uint64_t d, int s, uint64_t b,
+                    int t, uint64_t c, int l)
+{
+    y ^= (y >> u) & d;
+    y ^= (y << s) & w1 & b;
+    y ^= (y << t) & w1 & c;
+    y ^= y >> l;
+    return y;
+}
+
+/* Rows of the state with at most this many terms are kept as sorted lists of columns
+   rather than in S. The state starts out that way, and it takes a few rounds of twists
+   for the rows to fill up, which covers the outputs of a typical recovery. */
+#define MT_SPARSE_MAX 64
+#define MT_DENSE -1
+
+/* Stores row r from the columns cols[0..n), in S if there are too many of them. */
+static void
+mtengine_set_row(MTEngineObject *self, rci_t r, rci_t const *cols, int n)
+{
+    word *row;
+    int k;
+
+    if (n <= MT_SPARSE_MAX) {
+        memcpy(self->idx + (size_t)r * MT_SPARSE_MAX, cols, n * sizeof(rci_t));
+        self->len[r] = n;
+        return;
+    }
+    row = mzd_row(self->S, r);
+    memset(row, 0, self->S->width * sizeof(word));
+    for (k = 0; k < n; k++)
+        row[cols[k] / m4ri_radix] ^= m4ri_one << (cols[k] % m4ri_radix);
+    self->len[r] = MT_DENSE;
+}
+
+/* Stores row r from words in the layout of S, as a list if it has few enough terms. */
+static void
+mtengine_set_words(MTEngineObject *self, rci_t r, word const *words)
+{
+    rci_t *cols = self->idx + (size_t)r * MT_SPARSE_MAX;
+    word w;
+    wi_t i;
+    int n = 0;
+
+    for (i = 0; i < self->S->width; i++) {
+        for (w = words[i]; w != 0; w &= w - 1) {
+            if (n == MT_SPARSE_MAX) {
+                if (words != mzd_row(self->S, r))
+                    memcpy(mzd_row(self->S, r), words, self->S->width * sizeof(word));
+                self->len[r] = MT_DENSE;
+                return;
+            }
+            cols[n++] = i * m4ri_radix + __builtin_ctzll(w);
+        }
+    }
+    self->len[r] = n;
+}
+
+/* XORs row r of the state into `row`, which has the layout of S. */
+static void
+mtengine_xor_row(MTEngineObject *self, word *row, rci_t r)
+{
+    rci_t const *cols = self->idx + (size_t)r * MT_SPARSE_MAX;
+    word const *src;
+    wi_t i;
+    int k;
+
+    if (self->len[r] != MT_DENSE) {
+        for (k = 0; k < self->len[r]; k++)
+            row[cols[k] / m4ri_radix] ^= m4ri_one << (cols[k] % m4ri_radix);
+        return;
+    }
+    src = mzd_row(self->S, r);
+    for (i = 0; i < self->S->width; i++)
+        row[i] ^= src[i];
+}
+
+/* Sets row dst to the XOR of rows src[0..nsrc), none of which may be dst. The result
+   stays a list while every source is one and it has few enough terms. */
+static void
+mtengine_combine(MTEngineObject *self, rci_t dst, rci_t const *src, int nsrc)
+{
+    rci_t buf[2][3 * MT_SPARSE_MAX], *cur = NULL, *out, *b;
+    word *row;
+    int n = 0, nb, i, j, k, q;
+
+    for (q = 0; q < nsrc; q++)
+        if (self->len[src[q]] == MT_DENSE)
+            break;
+    if (q < nsrc) {
+        row = mzd_row(self->S, dst);
+        memcpy(row, mzd_row(self->S, src[q]), self->S->width * sizeof(word));
+        for (k = 0; k < nsrc; k++)
+            if (k != q)
+                mtengine_xor_row(self, row, src[k]);
+        self->len[dst] = MT_DENSE;
+        return;
+    }
+
+    // Symmetric difference of the sorted lists, one source at a time
+    for (q = 0; q < nsrc; q++) {
+        b = self->idx + (size_t)src[q] * MT_SPARSE_MAX;
+        nb = self->len[src[q]];
+        if (q == 0) {
+            cur = b;
+            n = nb;
+            continue;
+        }
+        out = buf[q % 2];
+        for (i = j = k = 0; i < n || j < nb; ) {
+            if (j == nb || (i < n && cur[i] < b[j]))
+                out[k++] = cur[i++];
+            else if (i == n || b[j] < cur[i])
+                out[k++] = b[j++];
+            else
+                i++, j++;
+        }
+        cur = out;
+        n = k;
+    }
+    mtengine_set_row(self, dst, cur, n);
+}
+
+static PyObject *
+mtengine_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "mt", "mti", "w", "n", "m", "r", "a", "u", "d", "s", "b",
+                              "t", "c", "l", NULL };
+    MTEngineObject *self;
+    BitVecObject *vec;
+    BitExprObject *expr;
+    BitSetObject *mask;
+    PyObject *arg, *seq, **items;
+    Py_ssize_t mti, constcol, i, j, k;
+    rci_t q, *cols;
+    word *row;
+    unsigned long long a, d, b, c, w1, y;
+    int w, n, m, r, u, sh, t, l;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OniiiiKiKiKiKi", kwlist, &arg, &mti,
+                                     &w, &n, &m, &r, &a, &u, &d, &sh, &b, &t, &c, &l))
+        return NULL;
+    if (w < 1 || w > 64 || n < 2 || m < 1 || m >= n || r < 0 || r > w ||
+            Py_MIN(Py_MIN(u, sh), Py_MIN(t, l)) < 0 ||
+            Py_MAX(Py_MAX(u, sh), Py_MAX(t, l)) >= w) {
+        PyErr_SetString(PyExc_ValueError, "invalid parameters");
+        return NULL;
+    }
+    if (mti < 0 || mti >= n) {
+        PyErr_SetString(PyExc_ValueError, "mti out of range");
+        return NULL;
+    }
+
+    seq = PySequence_Fast(arg, "mt is not iterable");
+    if (seq == NULL)
+        return NULL;
+    if (PySequence_Fast_GET_SIZE(seq) != n) {
+        PyErr_Format(PyExc_ValueError, "expected a state of %d words", n);
+        Py_DECREF(seq);
+        return NULL;
+    }
+    items = PySequence_Fast_ITEMS(seq);
+    for (i = 0; i < n; i++) {
+        if (!BitVec_Check(items[i]) || Py_SIZE(items[i]) != w) {
+            PyErr_Format(PyExc_TypeError, "state must consist of %d-bit BitVecs", w);
+            Py_DECREF(seq);
+            return NULL;
+        }
+        if (!Py_Is(((BitVecObject *)items[i])->system, ((BitVecObject *)items[0])->system)) {
+            PyErr_SetString(PyExc_TypeError, "state cannot contain differing linear systems");
+            Py_DECREF(seq);
+            return NULL;
+        }
+    }
+
+    self = (MTEngineObject *)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+    vec = (BitVecObject *)items[0];
+    self->system = Py_NewRef(vec->system);
+    self->w = w, self->n = n, self->m = m, self->r = r;
+    self->a = a;
+    self->mti = mti;
+
+    // One row per bit of the state, plus the scratch row
+    constcol = BV_CONST_COL(((LinearSystemObject *)vec->system)->bits);
+    self->S = mzd_init(n * w + 1, constcol + 1);
+    self->idx = PyMem_New(rci_t, (size_t)(n * w + 1) * MT_SPARSE_MAX);
+    self->len = PyMem_New(int, n * w + 1);
+    if (self->idx == NULL || self->len == NULL) {
+        Py_DECREF(seq);
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    for (i = 0; i < n; i++) {
+        vec = (BitVecObject *)items[i];
+        for (j = 0; j < w; j++) {
+            q = (rci_t)(i * w + j);
+            if (vec->M != NULL) {
+                mtengine_set_words(self, q, mzd_row(vec->M, (rci_t)j));
+                continue;
+            }
+            expr = (BitExprObject *)vec->exprs[j];
+            mask = (BitSetObject *)expr->mask;
+            if (mask->sparse && Py_SIZE(mask) < MT_SPARSE_MAX) {
+                cols = self->idx + (size_t)q * MT_SPARSE_MAX;
+                for (k = 0; k < Py_SIZE(mask); k++)
+                    cols[k] = (rci_t)mask->buf[k];
+                if (expr->compl)
+                    cols[k++] = (rci_t)constcol;
+                self->len[q] = (int)k;
+                continue;
+            }
+            row = mzd_row(self->S, q);
+            memset(row, 0, self->S->width * sizeof(word));
+            bitset_xor_into(mask, row);
+            if (expr->compl)
+                row[constcol / m4ri_radix] ^= m4ri_one << (constcol % m4ri_radix);
+            mtengine_set_words(self, q, row);
+        }
+    }
+    Py_DECREF(seq);
+
+    // Tempering is linear, so it is recorded from the images of the unit vectors
+    w1 = w == 64 ? ~0ULL : (1ULL << w) - 1;
+    memset(self->T, 0, sizeof(self->T));
+    for (j = 0; j < w; j++) {
+        y = mtengine_temper_int(1ULL << j, w1, u, d, sh, b, t, c, l) & w1;
+        for (i = 0; i < w; i++)
+            self->T[i] |= ((y >> i) & 1) << j;
+    }
+    return (PyObject *)self;
+}
+
+/* Twists word mti: mt[i] = mt[i + m] ^ (y >> 1) ^ (y & 1 ? a : 0), where y takes its top
+   w - r bits from mt[i] and its low r bits from mt[i + 1]. Bit j of the new word only
+   needs bit j + 1 of y, so the word is overwritten in place from the bottom up; only bit
+   0 of y, which every bit may need, is saved first, in the scratch row. */
+static void
+mtengine_twist(MTEngineObject *self)
+{
+    Py_ssize_t i = self->mti, i1 = (i + 1) % self->n, im = (i + self->m) % self->n;
+    rci_t y0 = self->n * self->w, src[3];
+    int w = self->w, j, k;
+
+#define Y_ROW(j) ((rci_t)((((j) < self->r ? i1 : i) * w + (j))))
+    src[0] = Y_ROW(0);
+    mtengine_combine(self, y0, src, 1);
+    for (j = 0; j < w; j++) {
+        k = 0;
+        src[k++] = (rci_t)(im * w + j);
+        if (j + 1 < w)
+            src[k++] = Y_ROW(j + 1);
+        if ((self->a >> j) & 1)
+            src[k++] = y0;
+        mtengine_combine(self, (rci_t)(i * w + j), src, k);
+    }
+#undef Y_ROW
+}
+
+/* XORs row r of the state into a row of the solver's store. */
+static void
+mtengine_emit_row(MTEngineObject *self, SolverObject *solver, word *row, rci_t r)
+{
+    rci_t const *cols = self->idx + (size_t)r * MT_SPARSE_MAX;
+    rci_t constcol = (rci_t)BV_CONST_COL(solver->rows->ncols - 1);
+    int k;
+
+    if (self->len[r] == MT_DENSE) {
+        row_xor_packed(solver, row, mzd_row(self->S, r));
+        return;
+    }
+    for (k = 0; k < self->len[r]; k++) {
+        if (cols[k] == constcol)
+            solver_flip_rhs(solver, row);
+        else
+            row[cols[k] / m4ri_radix] ^= m4ri_one << (cols[k] % m4ri_radix);
+    }
+}
+
+/* Produces the next output. If solver is not NULL, also adds the equations saying that
+   bits [shift, shift + nbits) of the tempered output equal the low nbits of value. */
+static int
+mtengine_emit(MTEngineObject *self, SolverObject *solver, uint64_t value, int shift,
+              int nbits)
+{
+    Py_ssize_t base;
+    uint64_t mask;
+    word *row;
+    int q;
+
+    mtengine_twist(self);
+    base = self->mti * self->w;
+    self->mti = (self->mti + 1) % self->n;
+    if (solver == NULL)
+        return 0;
+
+    if (solver_reserve(solver, nbits) < 0)
+        return -1;
+    for (q = 0; q < nbits; q++) {
+        row = solver_push_row(solver);
+        for (mask = self->T[shift + q]; mask != 0; mask &= mask - 1)
+            mtengine_emit_row(self, solver, row, (rci_t)(base + __builtin_ctzll(mask)));
+        if ((value >> q) & 1)
+            solver_flip_rhs(solver, row);
+        solver_pop_if_trivial(solver, row);
+    }
+    return solver_maybe_flush(solver);
+}
+
+/* Makes room for the rows of the outputs up front, up to as many as the solver keeps
+   pending before a flush, so that the store does not grow one output at a time. */
+static int
+mtengine_reserve(SolverObject *solver, PyObject *outputs, Py_ssize_t rows_per_output)
+{
+    Py_ssize_t hint, limit;
+
+    hint = PyObject_LengthHint(outputs, 0);
+    if (hint < 0)
+        return -1;
+    limit = Py_MAX(solver->rows->ncols, SOLVER_FLUSH_ROWS) / rows_per_output + 1;
+    return solver_reserve(solver, Py_MIN(hint, limit) * rows_per_output);
+}
+
+static int
+mtengine_prepare(MTEngineObject *self, SolverObject *solver)
+{
+    if (!PyObject_TypeCheck(solver, &Solver_Type)) {
+        PyErr_Format(PyExc_TypeError, "expected Solver, got: '%.200s'",
+                     Py_TYPE(solver)->tp_name);
+        return -1;
+    }
+    if (solver_check_busy(solver) < 0)
+        return -1;
+    return solver_bind(solver, self->system);
+}
+
+static PyObject *
+mtengine_getrandbits(MTEngineObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "solver", "outputs", "k", NULL };
+    SolverObject *solver;
+    PyObject *outputs, *iter, *out;
+    uint8_t *buf = NULL;
+    Py_ssize_t k = self->w, i, take, q;
+    uint64_t chunk;
+    int err = -1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|n:getrandbits", kwlist,
+                                     &solver, &outputs, &k))
+        return NULL;
+    if (mtengine_prepare(self, solver) < 0)
+        return NULL;
+    if (k <= 0) {
+        PyErr_SetString(PyExc_ValueError, "number of bits must be positive");
+        return NULL;
+    }
+    if (mtengine_reserve(solver, outputs, k) < 0)
+        return NULL;
+    buf = (uint8_t *)PyMem_Malloc((k + 7) / 8 + 8);
+    if (buf == NULL)
+        return PyErr_NoMemory();
+    iter = PyObject_GetIter(outputs);
+    if (iter == NULL)
+        goto done;
+
+    // Like CPython's getrandbits(): whole words from the low end up, with the top word
+    // shifted down to the bits that are left
+    while ((out = PyIter_Next(iter)) != NULL) {
+        if (out == Py_None) {
+            for (i = 0; i < k; i += self->w)
+                mtengine_emit(self, NULL, 0, 0, 0);
+            Py_DECREF(out);
+            continue;
+        }
+        if (!PyLong_Check(out) || Py_SIZE(out) < 0 || _PyLong_NumBits(out) > (size_t)k) {
+            PyErr_Format(PyExc_ValueError, "output must be None or an int of at most "
+                         "%zd bits", k);
+            Py_DECREF(out);
+            goto done;
+        }
+        memset(buf, 0, (k + 7) / 8 + 8);
+        err = _PyLong_AsByteArray((PyLongObject *)out, buf, (k + 7) / 8, 1, 0);
+        Py_DECREF(out);
+        if (err < 0)
+            goto done;
+        err = -1;
+        for (i = 0; i < k; i += self->w) {
+            take = Py_MIN(self->w, k - i);
+            for (chunk = 0, q = 0; q < take; q++)
+                chunk |= (uint64_t)((buf[(i + q) / 8] >> ((i + q) % 8)) & 1) << q;
+            if (mtengine_emit(self, solver, chunk, self->w - take, take) < 0)
+                goto done;
+        }
+    }
+    if (!PyErr_Occurred())
+        err = 0;
+
+done:
+    Py_XDECREF(iter);
+    PyMem_Free(buf);
+    if (err < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+mtengine_random(MTEngineObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "solver", "outputs", NULL };
+    SolverObject *solver;
+    PyObject *outputs, *iter, *out;
+    double x;
+    uint64_t v;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO:random", kwlist, &solver, &outputs))
+        return NULL;
+    if (self->w != 32) {
+        PyErr_SetString(PyExc_ValueError, "random() is only defined for 32-bit words");
+        return NULL;
+    }
+    if (mtengine_prepare(self, solver) < 0 || mtengine_reserve(solver, outputs, 53) < 0)
+        return NULL;
+    iter = PyObject_GetIter(outputs);
+    if (iter == NULL)
+        return NULL;
+
+    // CPython's random() is (a * 2^26 + b) / 2^53 with a = out1 >> 5 and b = out2 >> 6
+    while ((out = PyIter_Next(iter)) != NULL) {
+        if (out == Py_None) {
+            Py_DECREF(out);
+            mtengine_emit(self, NULL, 0, 0, 0);
+            mtengine_emit(self, NULL, 0, 0, 0);
+            continue;
+        }
+        x = PyFloat_AsDouble(out);
+        Py_DECREF(out);
+        if (x == -1.0 && PyErr_Occurred())
+            break;
+        x *= 9007199254740992.0;
+        if (!(x >= 0.0 && x < 9007199254740992.0) || x != (double)(uint64_t)x) {
+            PyErr_SetString(PyExc_ValueError, "output is not a value of random()");
+            break;
+        }
+        v = (uint64_t)x;
+        if (mtengine_emit(self, solver, v >> 26, 5, 27) < 0 ||
+                mtengine_emit(self, solver, v & ((1 << 26) - 1), 6, 26) < 0)
+            break;
+    }
+    Py_DECREF(iter);
+    if (PyErr_Occurred())
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+/* Returns the current state as a list of packed BitVecs. */
+static PyObject *
+mtengine_state(MTEngineObject *self, PyObject *Py_UNUSED(ignored))
+{
+    BitVecObject *vec;
+    PyObject *result;
+    Py_ssize_t i, j;
+
+    result = PyList_New(self->n);
+    if (result == NULL)
+        return NULL;
+    for (i = 0; i < self->n; i++) {
+        vec = (BitVecObject *)bitvec_from_matrix(&BitVec_Type, self->w, self->system);
+        if (vec == NULL) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        for (j = 0; j < self->w; j++)
+            mtengine_xor_row(self, mzd_row(vec->M, (rci_t)j), (rci_t)(i * self->w + j));
+        PyList_SET_ITEM(result, i, (PyObject *)vec);
+    }
+    return result;
+}
+
+static void
+mtengine_dealloc(MTEngineObject *self)
+{
+    Py_XDECREF(self->system);
+    mzd_xfree(self->S);
+    PyMem_Free(self->idx);
+    PyMem_Free(self->len);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyMethodDef mtengine_methods[] = {
+    { "getrandbits", (PyCFunction)mtengine_getrandbits, METH_VARARGS | METH_KEYWORDS,
+      NULL },
+    { "random", (PyCFunction)mtengine_random, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "state", (PyCFunction)mtengine_state, METH_NOARGS, NULL },
+    { NULL },
+};
+
+static PyMemberDef mtengine_members[] = {
+    { "system", T_OBJECT, offsetof(MTEngineObject, system), READONLY, NULL },
+    { "mti", T_PYSSIZET, offsetof(MTEngineObject, mti), READONLY, NULL },
+    { NULL },
+};
+
+static PyTypeObject MTEngine_Type = {
+    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "xorsat.MTEngine",
+    .tp_basicsize = sizeof(MTEngineObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)mtengine_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = NULL,
+    .tp_methods = mtengine_methods,
+    .tp_members = mtengine_members,
+    .tp_new = mtengine_new,
+};
+
+/* ============================= Small systems ============================== */
+
+/* Solves the equations of solve_zeros() without m4ri, for systems with at most
+   SMALL_MAX_COLS variables. Items have already been validated. */
+static PyObject *
+solve_small(LinearSystemObject *system, PyObject **items, Py_ssize_t size,
+            rci_t nrows, int all, model_format_t format)
+{
+    BitExprObject *expr;
+    BitMatrixObject *block;
+    BitSetObject *mask;
+    PyObject *result = NULL;
+    rci_t cols = (rci_t)system->bits, rank, nfree, r, c, j, f;
+    rci_t *pivots = NULL;
+    word *rows, *row, *xrow, dot;
+    mzd_t *x, *kernel;
+    Py_ssize_t i;
+    wi_t k;
+    int W;
+
+    // Rows are stored augmented, with the right-hand side in column cols
+    W = (cols + 1 + m4ri_radix - 1) / m4ri_radix;
+
+    rows = (word *)PyMem_Calloc((size_t)nrows * W, sizeof(word));
+    pivots = PyMem_New(rci_t, cols + 1);
+    if (rows == NULL || pivots == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    for (i = r = 0; i < size; i++) {
+        if (BitExpr_Check(items[i])) {
+            expr = (BitExprObject *)items[i];
+            mask = (BitSetObject *)expr->mask;
+            row = rows + r * W;
+            bitset_xor_into(mask, row);
+            row[cols / m4ri_radix] |= (word)expr->compl << (cols % m4ri_radix);
+            r++;
+            continue;
+        }
+        block = (BitMatrixObject *)items[i];
+        for (j = 0; j < block->M->nrows; j++, r++)
+            memcpy(rows + r * W, mzd_row(block->M, j), block->M->width * sizeof(word));
+    }
+
+    // The kernel needs the reduced form, a single solution only back-substitution
+    rank = small_echelonize(rows, W, nrows, cols, pivots, all);
+
+    // Rows past the rank have nothing left of their left-hand side, so any bit still
+    // set is a 1 on the right
+    for (i = (Py_ssize_t)rank * W; i < (Py_ssize_t)nrows * W; i++) {
+        if (rows[i]) {
+            PyErr_SetString(PyExc_ValueError, "no solution");
+            goto done;
+        }
+    }
+
+    // Free variables are 0. The bits of x at and before each pivot are still zero when
+    // its row is reached, so the whole row can be dotted.
+    x = mzd_init(1, cols);
+    xrow = mzd_row(x, 0);
+    for (r = rank; r--; ) {
+        row = rows + r * W;
+        dot = (row[cols / m4ri_radix] >> (cols % m4ri_radix)) & 1;
+        for (k = 0; k < x->width; k++)
+            dot ^= __builtin_popcountll(row[k] & xrow[k]);
+        if (dot & 1)
+            xrow[pivots[r] / m4ri_radix] |= m4ri_one << (pivots[r] % m4ri_radix);
+    }
+    if (!all) {
+        result = generate_model(x, system, format);
+        mzd_free(x);
+        goto done;
+    }
+
+    // One kernel vector per free column f: f itself plus every pivot whose row has f
+    nfree = cols - rank;
+    kernel = mzd_init(nfree, cols);
+    pivots[rank] = cols;
+    for (c = r = f = 0; c < cols; c++) {
+        if (c == pivots[r]) {
+            r++;
+            continue;
+        }
+        mzd_write_bit(kernel, f, c, 1);
+        for (j = 0; j < rank; j++)
+            if ((rows[j * W + c / m4ri_radix] >> (c % m4ri_radix)) & 1)
+                mzd_write_bit(kernel, f, pivots[j], 1);
+        f++;
+    }
+    result = solveiter_create(system, x, kernel, format);
+
+done:
+    PyMem_Free(rows);
+    PyMem_Free(pivots);
+    return result;
+}
+
+/* ================================ Presolve ================================ */
+
+/* Row states during presolve */
+#define PRESOLVE_ACTIVE 0
+#define PRESOLVE_DROPPED 1  /* folded into the union-find */
+#define PRESOLVE_PEELED 2   /* solved for a column that no other row contains */
+
+static void
+presolve_free(presolve_t *p)
+{
+    PyMem_Free(p->parent);
+    PyMem_Free(p->parity);
+    PyMem_Free(p->merged);
+    PyMem_Free(p->state);
+    PyMem_Free(p->count);
+    PyMem_Free(p->owner);
+    PyMem_Free(p->peeled);
+    PyMem_Free(p->peeled_cols);
+    PyMem_Free(p->index);
+    PyMem_Free(p->core);
+}
+
+/* Allocates the presolve state for the augmented system M. */
+static int
+presolve_init(presolve_t *p, mzd_t const *M)
+{
+    rci_t c;
+
+    p->rows = M->nrows;
+    p->cols = M->ncols - 1;
+    p->parent = (rci_t *)PyMem_Malloc((p->cols + 1) * sizeof(rci_t));
+    p->parity = (uint8_t *)PyMem_Calloc(p->cols + 1, 1);
+    p->merged = (word *)PyMem_Calloc(M->width, sizeof(word));
+    p->state = (uint8_t *)PyMem_Calloc(p->rows, 1);
+    p->count = (rci_t *)PyMem_Calloc(p->cols, sizeof(rci_t));
+    p->owner = (rci_t *)PyMem_Calloc(p->cols, sizeof(rci_t));
+    p->peeled = (rci_t *)PyMem_Malloc(p->rows * sizeof(rci_t));
+    p->peeled_cols = (rci_t *)PyMem_Malloc(p->rows * sizeof(rci_t));
+    p->index = (rci_t *)PyMem_Calloc(p->cols, sizeof(rci_t));
+    p->core = (rci_t *)PyMem_Malloc(p->cols * sizeof(rci_t));
+    if (p->parent == NULL || p->parity == NULL || p->merged == NULL || p->state == NULL ||
+        p->count == NULL || p->owner == NULL || p->peeled == NULL ||
+        p->peeled_cols == NULL || p->index == NULL || p->core == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (c = 0; c <= p->cols; c++)
+        p->parent[c] = c;
+    p->npeeled = 0;
+    p->ncore = 0;
+    return 0;
+}
+
+/* Returns the root of column c, storing the parity of x[c] ^ x[root] in *parity. */
+static rci_t
+presolve_find(presolve_t *p, rci_t c, uint8_t *parity)
+{
+    rci_t root = c, next;
+    uint8_t acc = 0, t;
+
+    while (p->parent[root] != root) {
+        acc ^= p->parity[root];
+        root = p->parent[root];
+    }
+    *parity = acc;
+
+    // Point every column on the path straight at the root
+    while (c != root) {
+        next = p->parent[c];
+        t = p->parity[c];
+        p->parent[c] = root;
+        p->parity[c] = acc;
+        acc ^= t;
+        c = next;
+    }
+    return root;
+}
+
+/* Replaces every merged column of `row` by its root, so that only roots are left. */
+static void
+presolve_rewrite(presolve_t *p, word *row, wi_t width)
+{
+    rci_t c, root;
+    uint8_t parity;
+    wi_t i;
+    word w;
+
+    for (i = 0; i < width; i++) {
+        for (w = row[i] & p->merged[i]; w != 0; w &= w - 1) {
+            c = i * m4ri_radix + __builtin_ctzll(w);
+            row[i] ^= m4ri_one << (c % m4ri_radix);
+            root = presolve_find(p, c, &parity);
+            if (parity)
+                row[p->cols / m4ri_radix] ^= m4ri_one << (p->cols % m4ri_radix);
+            if (root != p->cols)
+                row[root / m4ri_radix] ^= m4ri_one << (root % m4ri_radix);
+        }
+    }
+}
+
+/* Folds the rows with at most two variables into the union-find until none are left:
+   x = b ties x to the constant, and x ^ y = b ties x to y. Every other row is rewritten
+   in terms of the remaining roots. Returns -1 if a row reduces to 0 = 1. */
+static int
+presolve_merge(presolve_t *p, mzd_t *M)
+{
+    rci_t cols = p->cols, r, c, n, found[2];
+    word *row, w;
+    wi_t i;
+    int changed;
+
+    do {
+        changed = 0;
+        for (r = 0; r < p->rows; r++) {
+            if (p->state[r] != PRESOLVE_ACTIVE)
+                continue;
+            row = mzd_row(M, r);
+            presolve_rewrite(p, row, M->width);
+
+            for (i = n = 0; i < M->width && n <= 2; i++) {
+                w = row[i];
+                if (i == cols / m4ri_radix)
+                    w &= ~(m4ri_one << (cols % m4ri_radix));
+                for (; w != 0 && n <= 2; w &= w - 1, n++)
+                    if (n < 2)
+                        found[n] = i * m4ri_radix + __builtin_ctzll(w);
+            }
+            if (n > 2)
+                continue;
+
+            if (n == 0) {
+                if (mzd_read_bit(M, r, cols))
+                    return -1;
+            } else {
+                c = found[0];
+                p->parent[c] = n == 1 ? cols : found[1];
+                p->parity[c] = mzd_read_bit(M, r, cols);
+                p->merged[c / m4ri_radix] |= m4ri_one << (c % m4ri_radix);
+                changed = 1;
+            }
+            p->state[r] = PRESOLVE_DROPPED;
+        }
+    } while (changed);
+    return 0;
+}
+
+/* Removes every column that only one active row contains, together with that row: the
+   row then just defines the column in terms of the others. Removing it can leave other
+   columns with a single row, so this repeats until no singleton columns are left. */
+static void
+presolve_peel(presolve_t *p, mzd_t const *M)
+{
+    rci_t cols = p->cols, r, c, d, nstack = 0;
+    rci_t *stack = p->core;     // not needed until the core is built
+    word const *row;
+    word *once, *twice, w, any = 0;
+    wi_t i;
+
+    // Cheap check with two words per column first, since dense systems rarely have any
+    once = (word *)PyMem_RawCalloc(2 * M->width, sizeof(word));
+    if (once != NULL) {
+        twice = once + M->width;
+        for (r = 0; r < p->rows; r++) {
+            if (p->state[r] != PRESOLVE_ACTIVE)
+                continue;
+            row = mzd_row(M, r);
+            for (i = 0; i < M->width; i++) {
+                twice[i] |= once[i] & row[i];
+                once[i] |= row[i];
+            }
+        }
+        once[cols / m4ri_radix] &= ~(m4ri_one << (cols % m4ri_radix));
+        for (i = 0; i < M->width; i++)
+            any |= once[i] & ~twice[i];
+        PyMem_RawFree(once);
+        if (any == 0)
+            return;
+    }
+
+    for (r = 0; r < p->rows; r++) {
+        if (p->state[r] != PRESOLVE_ACTIVE)
+            continue;
+        row = mzd_row(M, r);
+        for (i = 0; i < M->width; i++) {
+            for (w = row[i]; w != 0; w &= w - 1) {
+                c = i * m4ri_radix + __builtin_ctzll(w);
+                if (c < cols) {
+                    p->count[c]++;
+                    p->owner[c] ^= r;
+                }
+            }
+        }
+    }
+    for (c = 0; c < cols; c++)
+        if (p->count[c] == 1)
+            stack[nstack++] = c;
+
+    // A count only goes down, so each column is pushed at most once
+    while (nstack > 0) {
+        c = stack[--nstack];
+        if (p->count[c] != 1)
+            continue;
+        r = p->owner[c];
+        p->state[r] = PRESOLVE_PEELED;
+        p->peeled[p->npeeled] = r;
+        p->peeled_cols[p->npeeled++] = c;
+        p->index[c] = -1;
+
+        row = mzd_row(M, r);
+        for (i = 0; i < M->width; i++) {
+            for (w = row[i]; w != 0; w &= w - 1) {
+                d = i * m4ri_radix + __builtin_ctzll(w);
+                if (d < cols) {
+                    p->owner[d] ^= r;
+                    if (--p->count[d] == 1)
+                        stack[nstack++] = d;
+                }
+            }
+        }
+    }
+}
+
+/* Runs the presolve on M, rewriting its rows, and returns the core system over the
+   variables that are left, or NULL if nothing could be eliminated. Does not need the
+   GIL. Returns -1 in *err if the system has no solution. */
+static mzd_t *
+presolve_run(presolve_t *p, mzd_t *M, int *err)
+{
+    rci_t cols = p->cols, nrows = 0, r, c, k;
+    uint8_t parity;
+    word const *row;
+    word w;
+    wi_t i;
+    mzd_t *C;
+
+    *err = presolve_merge(p, M);
+    if (*err < 0)
+        return NULL;
+    presolve_peel(p, M);
+
+    for (c = 0; c < cols; c++) {
+        if (p->parent[c] != c) {
+            presolve_find(p, c, &parity);
+            p->index[c] = -1;
+        } else if (p->index[c] == 0) {
+            p->index[c] = p->ncore;
+            p->core[p->ncore++] = c;
+        }
+    }
+    for (r = 0; r < p->rows; r++)
+        nrows += p->state[r] == PRESOLVE_ACTIVE;
+    if (p->ncore == cols && nrows == p->rows)
+        return NULL;
+
+    // Only roots are left in the active rows, and none of them was peeled
+    C = mzd_init(nrows, p->ncore + 1);
+    for (r = k = 0; r < p->rows; r++) {
+        if (p->state[r] != PRESOLVE_ACTIVE)
+            continue;
+        row = mzd_row(M, r);
+        for (i = 0; i < M->width; i++) {
+            for (w = row[i]; w != 0; w &= w - 1) {
+                c = i * m4ri_radix + __builtin_ctzll(w);
+                mzd_write_bit(C, k, c < cols ? p->index[c] : p->ncore, 1);
+            }
+        }
+        k++;
+    }
+    return C;
+}
+
+/* Expands a solution y of the core to the solution x of the whole system, which must be
+   zeroed. With `affine` unset, the right-hand sides are taken as 0, which maps the
+   kernel of the core onto the kernel of the system. M holds the rewritten rows. */
+static void
+presolve_expand(presolve_t const *p, mzd_t const *M, word const *y, word *x,
+                int affine)
+{
+    rci_t cols = p->cols, width = (cols + m4ri_radix - 1) / m4ri_radix, r, c, root, k;
+    word const *row;
+    word dot;
+    uint8_t bit;
+    wi_t i;
+
+    for (k = 0; k < p->ncore; k++) {
+        if ((y[k / m4ri_radix] >> (k % m4ri_radix)) & 1) {
+            c = p->core[k];
+            x[c / m4ri_radix] |= m4ri_one << (c % m4ri_radix);
+        }
+    }
+
+    // A peeled row can contain columns peeled after it, but none peeled before it
+    for (k = p->npeeled; k--; ) {
+        r = p->peeled[k];
+        c = p->peeled_cols[k];
+        row = mzd_row(M, r);
+        dot = 0;
+        for (i = 0; i < width; i++)
+            dot ^= row[i] & x[i];
+        bit = (__builtin_popcountll(dot) & 1) ^ (affine & mzd_read_bit(M, r, cols));
+        x[c / m4ri_radix] |= (word)bit << (c % m4ri_radix);
+    }
+
+    // The union-find is flattened, so every merged column points at a root
+    for (c = 0; c < cols; c++) {
+        root = p->parent[c];
+        if (root == c)
+            continue;
+        bit = affine & p->parity[c];
+        if (root != cols)
+            bit ^= (x[root / m4ri_radix] >> (root % m4ri_radix)) & 1;
+        x[c / m4ri_radix] |= (word)bit << (c % m4ri_radix);
+    }
+}
+
+/* =============================== Components =============================== */
+
+/* Most expensive first */
+static int
+component_compare(const void *a, const void *b)
+{
+    double ca = ((const component_t *)a)->cost, cb = ((const component_t *)b)->cost;
+
+    return (ca < cb) - (ca > cb);
+}
+
+static void
+component_solve_task(void *arg, Py_ssize_t i)
+{
+    component_t *comp = &((component_t *)arg)[i];
+    rci_t rank;
+    int prev;
+
+    prev = set_num_threads(comp->threads);
+    rank = mzd_echelonize(comp->A, 0);
+    comp->x = mzd_init(1, comp->A->ncols - 1);
+    comp->err = echelon_solve(comp->A, rank, comp->x);
+    if (comp->err == 0 && comp->all)
+        comp->kernel = echelon_kernel(comp->A, rank, comp->A->ncols - 1);
+    set_num_threads(prev);
+}
+
+static rci_t
+component_find(rci_t *parent, rci_t c)
+{
+    while (parent[c] != c) {
+        parent[c] = parent[parent[c]];
+        c = parent[c];
+    }
+    return c;
+}
+
+/* Checks cheaply whether the variables of E are all connected through its rows, which
+   is the common case for dense systems: the columns reachable from the first row are
+   grown a word at a time, for a few passes over the rows. Returns 0 if it could not
+   tell. */
+static int
+components_connected(mzd_t const *E)
+{
+    rci_t cols = E->ncols - 1, r, left = E->nrows;
+    word *reach, v, hit, any;
+    word const *row;
+    wi_t i;
+    uint8_t *done;
+    int pass, found = 1, seeded = 0;
+
+    reach = (word *)PyMem_RawCalloc(E->width, sizeof(word));
+    done = (uint8_t *)PyMem_RawCalloc(E->nrows, 1);
+    if (reach == NULL || done == NULL)
+        goto done;
+
+    for (pass = 0; pass < 4 && left > 0 && found; pass++) {
+        found = 0;
+        for (r = 0; r < E->nrows; r++) {
+            if (done[r])
+                continue;
+            row = mzd_row(E, r);
+            hit = any = 0;
+            for (i = 0; i < E->width; i++) {
+                v = row[i];
+                if (i == cols / m4ri_radix)
+                    v &= ~(m4ri_one << (cols % m4ri_radix));
+                hit |= reach[i] & v;
+                any |= v;
+            }
+            // Rows without variables do not connect anything
+            if (any != 0 && hit == 0 && seeded)
+                continue;
+            for (i = 0; i < E->width; i++)
+                reach[i] |= row[i];
+            seeded |= any != 0;
+            done[r] = 1;
+            found = 1;
+            left--;
+        }
+    }
+
+done:
+    PyMem_RawFree(reach);
+    PyMem_RawFree(done);
+    return left == 0;
+}
+
+/* Solves the augmented system E, which must not be echelonized yet, one connected
+   component of the graph between its variables and its rows at a time, on up to
+   `workers` threads. Stores a solution in x (1 x cols, zeroed), and the transposed
+   kernel in *kernel unless it is NULL. Returns 1 without storing anything if E is a
+   single component, and -1 if the system has no solution. Does not need the GIL. */
+static int
+components_solve(mzd_t *E, mzd_t *x, mzd_t **kernel, int workers)
+{
+    rci_t cols = E->ncols - 1, ncomp = 0, nfree = 0, r, c, k, n, first;
+    rci_t *parent = NULL, *label = NULL, *local = NULL, *colmap = NULL, *rowcomp = NULL;
+    rci_t *nrows = NULL, *ncols;
+    component_t *comps = NULL;
+    word const *row;
+    word w;
+    wi_t i;
+    double total = 0;
+    int result = 1, threads;
+
+    if (E->nrows < 2 || cols < 2 || components_connected(E))
+        return 1;
+
+    parent = (rci_t *)PyMem_RawMalloc(cols * sizeof(rci_t));
+    label = (rci_t *)PyMem_RawMalloc(cols * sizeof(rci_t));
+    local = (rci_t *)PyMem_RawMalloc(cols * sizeof(rci_t));
+    colmap = (rci_t *)PyMem_RawMalloc(cols * sizeof(rci_t));
+    rowcomp = (rci_t *)PyMem_RawMalloc(E->nrows * sizeof(rci_t));
+    if (parent == NULL || label == NULL || local == NULL || colmap == NULL ||
+        rowcomp == NULL)
+        goto done;
+    for (c = 0; c < cols; c++) {
+        parent[c] = c;
+        label[c] = -1;
+    }
+
+    // Every row joins the columns it contains
+    for (r = 0; r < E->nrows; r++) {
+        row = mzd_row(E, r);
+        first = -1;
+        for (i = 0; i < E->width; i++) {
+            for (w = row[i]; w != 0; w &= w - 1) {
+                c = i * m4ri_radix + __builtin_ctzll(w);
+                if (c == cols)
+                    break;
+                c = component_find(parent, c);
+                if (first < 0)
+                    first = c;
+                else if (c != first)
+                    parent[c] = first;
+            }
+        }
+        if (first < 0 && mzd_read_bit(E, r, cols)) {
+            result = -1;
+            goto done;
+        }
+        rowcomp[r] = first;
+    }
+
+    // Number the components that have rows; columns in no row are free
+    for (r = 0; r < E->nrows; r++) {
+        if (rowcomp[r] < 0)
+            continue;
+        first = component_find(parent, rowcomp[r]);
+        if (label[first] < 0)
+            label[first] = ncomp++;
+        rowcomp[r] = label[first];
+    }
+    for (c = 0; c < cols; c++)
+        label[c] = label[component_find(parent, c)];
+    if (ncomp <= 1)
+        goto done;
+
+    comps = (component_t *)PyMem_RawCalloc(ncomp, sizeof(component_t));
+    nrows = (rci_t *)PyMem_RawCalloc(2 * ncomp, sizeof(rci_t));
+    if (comps == NULL || nrows == NULL)
+        goto done;
+    ncols = nrows + ncomp;
+    for (c = 0; c < cols; c++) {
+        if (label[c] < 0)
+            nfree++;
+        else
+            local[c] = ncols[label[c]]++;
+    }
+    for (r = 0; r < E->nrows; r++)
+        if (rowcomp[r] >= 0)
+            nrows[rowcomp[r]]++;
+    for (k = n = 0; k < ncomp; k++) {
+        comps[k].A = mzd_init(nrows[k], ncols[k] + 1);
+        comps[k].cols = colmap + n;
+        comps[k].all = kernel != NULL;
+        // Elimination is cubic
+        comps[k].cost = (double)nrows[k] * ncols[k] * ncols[k];
+        total += comps[k].cost;
+        n += ncols[k];
+        nrows[k] = 0;
+    }
+    for (c = 0; c < cols; c++)
+        if (label[c] >= 0)
+            comps[label[c]].cols[local[c]] = c;
+    for (r = 0; r < E->nrows; r++) {
+        if ((k = rowcomp[r]) < 0)
+            continue;
+        row = mzd_row(E, r);
+        for (i = 0; i < E->width; i++) {
+            for (w = row[i]; w != 0; w &= w - 1) {
+                c = i * m4ri_radix + __builtin_ctzll(w);
+                mzd_write_bit(comps[k].A, nrows[k], c < cols ? local[c] : ncols[k], 1);
+            }
+        }
+        nrows[k]++;
+    }
+
+    // As in solve_many(), a component gets OpenMP threads in proportion to its share
+    // of the work
+    for (k = 0; k < ncomp; k++) {
+        threads = total > 0 ? (int)(workers * comps[k].cost / total) : 1;
+        comps[k].threads = Py_MAX(1, Py_MIN(threads, workers));
+    }
+    qsort(comps, ncomp, sizeof(component_t), component_compare);
+    worker_pool_map(component_solve_task, comps, ncomp, workers);
+
+    result = 0;
+    for (k = 0; k < ncomp; k++) {
+        if (comps[k].err < 0) {
+            result = -1;
+            goto done;
+        }
+    }
+
+    // Stitch the components back together through their column maps
+    for (k = 0; k < ncomp; k++)
+        for (c = 0; c < comps[k].x->ncols; c++)
+            if (mzd_read_bit(comps[k].x, 0, c))
+                mzd_write_bit(x, 0, comps[k].cols[c], 1);
+    if (kernel != NULL) {
+        n = nfree;
+        for (k = 0; k < ncomp; k++)
+            n += comps[k].kernel->nrows;
+        *kernel = mzd_init(n, cols);
+        n = 0;
+        for (k = 0; k < ncomp; k++) {
+            for (r = 0; r < comps[k].kernel->nrows; r++, n++)
+                for (c = 0; c < comps[k].kernel->ncols; c++)
+                    if (mzd_read_bit(comps[k].kernel, r, c))
+                        mzd_write_bit(*kernel, n, comps[k].cols[c], 1);
+        }
+        for (c = 0; c < cols; c++)
+            if (label[c] < 0)
+                mzd_write_bit(*kernel, n++, c, 1);
+    }
+
+done:
+    if (comps != NULL) {
+        for (k = 0; k < ncomp; k++) {
+            mzd_xfree(comps[k].A);
+            mzd_xfree(comps[k].x);
+            mzd_xfree(comps[k].kernel);
+        }
+    }
+    PyMem_RawFree(comps);
+    PyMem_RawFree(nrows);
+    PyMem_RawFree(parent);
+    PyMem_RawFree(label);
+    PyMem_RawFree(local);
+    PyMem_RawFree(colmap);
+    PyMem_RawFree(rowcomp);
+    return result;
+}
+
+/* Solves the augmented system E, which must not be echelonized yet, storing a solution
+   in x and, unless kernel is NULL, the transposed kernel in *kernel. Unrelated groups of
+   variables are solved as separate systems. Returns -1 if there is no solution. Does
+   not need the GIL. */
+static int
+solve_augmented(mzd_t *E, mzd_t *x, mzd_t **kernel, int workers)
+{
+    rci_t rank;
+    int err;
+
+    err = components_solve(E, x, kernel, workers);
+    if (err <= 0)
+        return err;
+
+    rank = E->nrows > 0 ? mzd_echelonize(E, 0) : 0;
+    err = echelon_solve(E, rank, x);
+    if (err == 0 && kernel != NULL)
+        *kernel = echelon_kernel(E, rank, E->ncols - 1);
+    return err;
+}
+
+/* Solves the augmented system M, which is overwritten. Presolve shrinks it first, then
+   what is left is eliminated a connected component at a time, and the core solution and
+   kernel are expanded to every variable afterwards. */
+PyObject *
+solve_matrix(LinearSystemObject *system, mzd_t *M, int all, model_format_t format,
+             int threads)
+{
+    PyObject *result = NULL;
+    rci_t cols = M->ncols - 1, r;
+    mzd_t *C = NULL, *E, *x = NULL, *y = NULL, *K = NULL, *kernel = NULL;
+    presolve_t p = { 0 };
+    int workers, prev, err;
+
+    if (presolve_init(&p, M) < 0)
+        return NULL;
+    workers = threads > 0 ? threads : cpu_count();
+
+    Py_BEGIN_ALLOW_THREADS
+    prev = set_num_threads(threads);
+    C = presolve_run(&p, M, &err);
+    if (err == 0) {
+        E = C != NULL ? C : M;
+        y = mzd_init(1, E->ncols - 1);
+        err = solve_augmented(E, y, all ? &K : NULL, workers);
+    }
+    if (err == 0 && C != NULL) {
+        x = mzd_init(1, cols);
+        presolve_expand(&p, M, mzd_row(y, 0), mzd_row(x, 0), 1);
+        if (all) {
+            kernel = mzd_init(K->nrows, cols);
+            for (r = 0; r < K->nrows; r++)
+                presolve_expand(&p, M, mzd_row(K, r), mzd_row(kernel, r), 0);
+        }
+    } else if (err == 0) {
+        x = y;
+        kernel = K;
+        y = K = NULL;
+    }
+    set_num_threads(prev);
+    Py_END_ALLOW_THREADS
+    if (err < 0)
+        PyErr_SetString(PyExc_ValueError, "no solution");
+    else if (!all)
+        result = generate_model(x, system, format);
+    else {
+        result = solveiter_create(system, x, kernel, format);
+        x = kernel = NULL;
+    }
+
+    mzd_xfree(C);
+    mzd_xfree(x);
+    mzd_xfree(y);
+    mzd_xfree(K);
+    mzd_xfree(kernel);
+    presolve_free(&p);
+    return result;
+}
+
+/* ================================= Sparse ================================= */
+
+/* With method='auto', systems with at least this many variables whose equations contain
+   fewer than one in SPARSE_MIN_RATIO of them on average use the sparse engine */
+#define SPARSE_MIN_COLS (1 << 16)
+#define SPARSE_MIN_RATIO 64
+
+/* The core left by structured elimination is solved with m4ri if it has fewer than
+   SPARSE_LANCZOS_MIN_COLS variables, or at most SPARSE_DENSE_MAX_COLS and a matrix of at
+   most SPARSE_DENSE_MAX_BITS bits, and with block Lanczos otherwise */
+#define SPARSE_LANCZOS_MIN_COLS 256
+#define SPARSE_DENSE_MAX_COLS (1 << 14)
+#define SPARSE_DENSE_MAX_BITS 4294967296.0
+
+/* Structured elimination stops after this many rounds even if it could go on */
+#define SPARSE_MAX_ROUNDS 32
+
+/* Columns in more rows than this are only eliminated through rows of one or two
+   variables */
+#define SPARSE_MAX_WEIGHT 4
+
+/* Block Lanczos is restarted from a different random block this many times before it
+   gives up on a system, or on proving that the system has no solution */
+#define LANCZOS_ATTEMPTS 3
+
+/* Returned by sparse_solve_core() when block Lanczos gave up both ways */
+#define LANCZOS_GAVE_UP -3
+
+/* Row states during structured elimination */
+#define SPARSE_ACTIVE 0
+#define SPARSE_DROPPED 1    /* reduced to 0 = 0 */
+#define SPARSE_PIVOT 2      /* solved for one of its columns */
+
+static int
+index_list_append(index_list_t *list, rci_t value)
+{
+    rci_t *items, cap;
+
+    if (list->len == list->cap) {
+        cap = list->cap > 0 ? 2 * list->cap : 4;
+        items = (rci_t *)PyMem_RawRealloc(list->items, cap * sizeof(rci_t));
+        if (items == NULL)
+            return -1;
+        list->items = items;
+        list->cap = cap;
+    }
+    list->items[list->len++] = value;
+    return 0;
+}
+
+/* Binary search in a sorted list */
+static int
+index_list_contains(index_list_t const *list, rci_t value)
+{
+    rci_t lo = 0, hi = list->len, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (list->items[mid] < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < list->len && list->items[lo] == value;
+}
+
+static void
+sparse_free(sparse_t *s)
+{
+    rci_t i;
+
+    if (s->row != NULL)
+        for (i = 0; i < s->rows; i++)
+            PyMem_RawFree(s->row[i].items);
+    if (s->occ != NULL)
+        for (i = 0; i < s->cols; i++)
+            PyMem_RawFree(s->occ[i].items);
+    PyMem_RawFree(s->row);
+    PyMem_RawFree(s->rhs);
+    PyMem_RawFree(s->state);
+    PyMem_RawFree(s->occ);
+    PyMem_RawFree(s->weight);
+    PyMem_RawFree(s->pivots);
+    PyMem_RawFree(s->pivot_cols);
+    PyMem_RawFree(s->scratch.items);
+}
+
+/* Stores the columns set in the first `cols` bits of `words` as a row of s. */
+static int
+sparse_set_words(sparse_t *s, rci_t r, word const *words)
+{
+    index_list_t *row = &s->row[r];
+    Py_ssize_t nwords = BS_SIZE(s->cols), i, n = 0;
+    word w;
+    rci_t c;
+
+    for (i = 0; i < nwords; i++)
+        n += __builtin_popcountll(words[i]);
+    row->items = (rci_t *)PyMem_RawMalloc(Py_MAX(n, 1) * sizeof(rci_t));
+    if (row->items == NULL)
+        return -1;
+    row->cap = (rci_t)Py_MAX(n, 1);
+    for (i = 0; i < nwords; i++) {
+        for (w = words[i]; w != 0; w &= w - 1) {
+            c = (rci_t)(i * m4ri_radix + __builtin_ctzll(w));
+            if (c < s->cols)
+                row->items[row->len++] = c;
+        }
+    }
+    return 0;
+}
+
+/* Builds the rows of s from the equations of solve_zeros(), which have already been
+   validated. */
+static int
+sparse_init(sparse_t *s, LinearSystemObject *system, PyObject **items, Py_ssize_t size,
+            rci_t rows)
+{
+    BitExprObject *expr;
+    BitMatrixObject *block;
+    BitSetObject *mask;
+    index_list_t *row;
+    Py_ssize_t i, j, k;
+    rci_t r, c;
+
+    s->rows = rows;
+    s->cols = (rci_t)system->bits;
+    s->row = (index_list_t *)PyMem_RawCalloc(rows, sizeof(index_list_t));
+    s->rhs = (uint8_t *)PyMem_RawCalloc(rows, 1);
+    s->state = (uint8_t *)PyMem_RawCalloc(rows, 1);
+    s->occ = (index_list_t *)PyMem_RawCalloc(Py_MAX(s->cols, 1), sizeof(index_list_t));
+    s->weight = (rci_t *)PyMem_RawCalloc(Py_MAX(s->cols, 1), sizeof(rci_t));
+    s->pivots = (rci_t *)PyMem_RawMalloc(rows * sizeof(rci_t));
+    s->pivot_cols = (rci_t *)PyMem_RawMalloc(rows * sizeof(rci_t));
+    if (s->row == NULL || s->rhs == NULL || s->state == NULL || s->occ == NULL ||
+        s->weight == NULL || s->pivots == NULL || s->pivot_cols == NULL)
+        goto nomem;
+
+    for (i = r = 0; i < size; i++) {
+        if (BitExpr_Check(items[i])) {
+            expr = (BitExprObject *)items[i];
+            mask = (BitSetObject *)expr->mask;
+            s->rhs[r] = expr->compl;
+            if (!mask->sparse) {
+                if (sparse_set_words(s, r++, mask->buf) < 0)
+                    goto nomem;
+                continue;
+            }
+            row = &s->row[r++];
+            row->cap = (rci_t)Py_MAX(Py_SIZE(mask), 1);
+            row->items = (rci_t *)PyMem_RawMalloc(row->cap * sizeof(rci_t));
+            if (row->items == NULL)
+                goto nomem;
+            for (k = 0; k < Py_SIZE(mask); k++)
+                row->items[row->len++] = (rci_t)mask->buf[k];
+            continue;
+        }
+        block = (BitMatrixObject *)items[i];
+        for (j = 0; j < block->M->nrows; j++, r++) {
+            s->rhs[r] = mzd_read_bit(block->M, (rci_t)j, s->cols);
+            if (sparse_set_words(s, r, mzd_row(block->M, (rci_t)j)) < 0)
+                goto nomem;
+        }
+    }
+
+    for (r = 0; r < rows; r++) {
+        for (k = 0; k < s->row[r].len; k++) {
+            c = s->row[r].items[k];
+            s->weight[c]++;
+            if (index_list_append(&s->occ[c], r) < 0)
+                goto nomem;
+        }
+    }
+    return 0;
+
+nomem:
+    PyErr_NoMemory();
+    return -1;
+}
+
+/* Replaces row `dst` by its XOR with row `src`, keeping the column weights and lists up
+   to date. */
+static void
+sparse_xor_rows(sparse_t *s, rci_t dst, rci_t src)
+{
+    index_list_t *a = &s->row[dst], *b = &s->row[src], *out = &s->scratch, tmp;
+    rci_t i = 0, j = 0, c, *items;
+
+    if (out->cap < a->len + b->len) {
+        items = (rci_t *)PyMem_RawRealloc(out->items, (a->len + b->len) * sizeof(rci_t));
+        if (items == NULL) {
+            s->nomem = 1;
+            return;
+        }
+        out->items = items;
+        out->cap = a->len + b->len;
+    }
+
+    out->len = 0;
+    while (i < a->len || j < b->len) {
+        if (j == b->len || (i < a->len && a->items[i] < b->items[j])) {
+            out->items[out->len++] = a->items[i++];
+            continue;
+        }
+        c = b->items[j++];
+        if (i < a->len && a->items[i] == c) {
+            s->weight[c]--;
+            i++;
+            continue;
+        }
+        out->items[out->len++] = c;
+        s->weight[c]++;
+        if (index_list_append(&s->occ[c], dst) < 0)
+            s->nomem = 1;
+    }
+    s->rhs[dst] ^= s->rhs[src];
+
+    tmp = *a;
+    *a = *out;
+    *out = tmp;
+}
+
+/* Solves row r for column c and eliminates c from every other active row. Returns -1 if
+   a row reduces to 0 = 1. */
+static int
+sparse_pivot(sparse_t *s, rci_t r, rci_t c)
+{
+    index_list_t *occ = &s->occ[c];
+    rci_t k, t;
+
+    s->state[r] = SPARSE_PIVOT;
+    s->pivots[s->npivots] = r;
+    s->pivot_cols[s->npivots++] = c;
+    for (k = 0; k < s->row[r].len; k++)
+        s->weight[s->row[r].items[k]]--;
+
+    // Rows that lost c since they were listed are skipped
+    for (k = 0; k < occ->len && !s->nomem; k++) {
+        t = occ->items[k];
+        if (s->state[t] != SPARSE_ACTIVE || !index_list_contains(&s->row[t], c))
+            continue;
+        sparse_xor_rows(s, t, r);
+        if (s->row[t].len == 0) {
+            if (s->rhs[t])
+                return -1;
+            s->state[t] = SPARSE_DROPPED;
+        }
+    }
+    occ->len = 0;
+    return 0;
+}
+
+/* Structured elimination: repeatedly solves rows of one or two variables, and columns
+   in few rows, as long as that does not add entries to the matrix. What is left is the
+   core. Returns -1 if the system has no solution. */
+static int
+sparse_reduce(sparse_t *s)
+{
+    index_list_t *occ;
+    rci_t npivots, r, c, k, t, best, w;
+    int round;
+
+    for (round = 0; round < SPARSE_MAX_ROUNDS && !s->nomem; round++) {
+        npivots = s->npivots;
+
+        for (r = 0; r < s->rows && !s->nomem; r++) {
+            if (s->state[r] != SPARSE_ACTIVE)
+                continue;
+            if (s->row[r].len == 0) {
+                if (s->rhs[r])
+                    return -1;
+                s->state[r] = SPARSE_DROPPED;
+            } else if (s->row[r].len <= 2 && sparse_pivot(s, r, s->row[r].items[0]) < 0)
+                return -1;
+        }
+
+        // Pivoting on a column in w rows through a row of k entries removes k entries
+        // and adds at most (w - 1) * (k - 2)
+        for (c = 0; c < s->cols && !s->nomem; c++) {
+            w = s->weight[c];
+            if (w == 0 || w > SPARSE_MAX_WEIGHT)
+                continue;
+            occ = &s->occ[c];
+            best = -1;
+            for (k = 0; k < occ->len; k++) {
+                t = occ->items[k];
+                if (s->state[t] == SPARSE_ACTIVE &&
+                    (best < 0 || s->row[t].len < s->row[best].len) &&
+                    index_list_contains(&s->row[t], c))
+                    best = t;
+            }
+            if (best >= 0 && (w - 1) * (s->row[best].len - 2) <= s->row[best].len &&
+                sparse_pivot(s, best, c) < 0)
+                return -1;
+        }
+
+        if (s->npivots == npivots)
+            break;
+    }
+    return 0;
+}
+
+/* Solves the eliminated variables in reverse order, once the core is solved in x. */
+static void
+sparse_expand(sparse_t const *s, word *x)
+{
+    index_list_t const *row;
+    rci_t k, i, c;
+    uint8_t bit;
+
+    for (k = s->npivots; k--; ) {
+        row = &s->row[s->pivots[k]];
+        c = s->pivot_cols[k];
+        bit = s->rhs[s->pivots[k]];
+        for (i = 0; i < row->len; i++)
+            if (row->items[i] != c)
+                bit ^= (x[row->items[i] / m4ri_radix] >> (row->items[i] % m4ri_radix)) & 1;
+        x[c / m4ri_radix] |= (word)bit << (c % m4ri_radix);
+    }
+}
+
+static uint64_t
+splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/* out = B^T B v for an n x 64 block v, with tmp holding the m x 64 block B v */
+static void
+lanczos_mul(sparse_matrix_t const *B, uint64_t const *v, uint64_t *out, uint64_t *tmp)
+{
+    Py_ssize_t r, c;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (r = 0; r < B->nrows; r++) {
+        uint64_t acc = 0;
+        Py_ssize_t k;
+
+        for (k = B->rowptr[r]; k < B->rowptr[r + 1]; k++)
+            acc ^= v[B->rowidx[k]];
+        tmp[r] = acc;
+    }
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (c = 0; c < B->ncols; c++) {
+        uint64_t acc = 0;
+        Py_ssize_t k;
+
+        for (k = B->colptr[c]; k < B->colptr[c + 1]; k++)
+            acc ^= tmp[B->colidx[k]];
+        out[c] = acc;
+    }
+}
+
+/* c = a^T b for n x 64 blocks a and b, a byte of a at a time */
+static void
+lanczos_inner(uint64_t const *a, uint64_t const *b, Py_ssize_t n, uint64_t *c)
+{
+    uint64_t table[8][256] = { { 0 } }, acc;
+    Py_ssize_t i;
+    int k, j, x;
+
+    for (i = 0; i < n; i++)
+        for (k = 0; k < 8; k++)
+            table[k][(a[i] >> (8 * k)) & 255] ^= b[i];
+    for (k = 0; k < 8; k++) {
+        for (j = 0; j < 8; j++) {
+            acc = 0;
+            for (x = 0; x < 256; x++)
+                if ((x >> j) & 1)
+                    acc ^= table[k][x];
+            c[8 * k + j] = acc;
+        }
+    }
+}
+
+/* y ^= v m for an n x 64 block v and a 64 x 64 matrix m */
+static void
+lanczos_mul_acc(uint64_t const *v, uint64_t const *m, Py_ssize_t n, uint64_t *y)
+{
+    uint64_t table[8][256];
+    Py_ssize_t i;
+    int k, x;
+
+    for (k = 0; k < 8; k++) {
+        table[k][0] = 0;
+        for (x = 1; x < 256; x++)
+            table[k][x] = table[k][x & (x - 1)] ^ m[8 * k + __builtin_ctz(x)];
+    }
+    for (i = 0; i < n; i++) {
+        uint64_t w = v[i];
+
+        y[i] ^= table[0][w & 255] ^ table[1][(w >> 8) & 255] ^
+                table[2][(w >> 16) & 255] ^ table[3][(w >> 24) & 255] ^
+                table[4][(w >> 32) & 255] ^ table[5][(w >> 40) & 255] ^
+                table[6][(w >> 48) & 255] ^ table[7][w >> 56];
+    }
+}
+
+/* c = a b for 64 x 64 matrices; c may be a or b */
+static void
+lanczos_mat_mul(uint64_t const *a, uint64_t const *b, uint64_t *c)
+{
+    uint64_t out[64], w, acc;
+    int i;
+
+    for (i = 0; i < 64; i++) {
+        acc = 0;
+        for (w = a[i]; w != 0; w &= w - 1)
+            acc ^= b[__builtin_ctzll(w)];
+        out[i] = acc;
+    }
+    memcpy(c, out, sizeof(out));
+}
+
+/* Montgomery's choice of the columns S of the next block: a set including every column
+   left out of the previous one (prev, of size prev_dim) for which S^T t S is invertible.
+   Stores the columns in s and the inverse, padded with zeros, in winv. Returns the size
+   of S, or 0 if the iteration broke down. */
+static int
+lanczos_select(uint64_t const *t, int *s, int const *prev, int prev_dim, uint64_t *winv)
+{
+    uint64_t M[64][2], mask = 0, m0, m1;
+    uint64_t *row_i, *row_j;
+    int i, j, dim, cols = 64;
+
+    for (i = 0; i < 64; i++) {
+        M[i][0] = t[i];
+        M[i][1] = (uint64_t)1 << i;
+    }
+
+    // Columns of the previous block go last
+    for (i = 0; i < prev_dim; i++) {
+        s[--cols] = prev[i];
+        mask |= (uint64_t)1 << prev[i];
+    }
+    for (i = j = 0; i < 64; i++)
+        if (!((mask >> i) & 1))
+            s[j++] = i;
+
+    // Invert t, skipping the columns that would make the submatrix singular
+    for (i = dim = 0; i < 64; i++) {
+        mask = (uint64_t)1 << s[i];
+        row_i = M[s[i]];
+        for (j = i; j < 64 && !(M[s[j]][0] & mask); j++)
+            ;
+        if (j < 64) {
+            row_j = M[s[j]];
+            m0 = row_j[0], m1 = row_j[1];
+            row_j[0] = row_i[0], row_j[1] = row_i[1];
+            row_i[0] = m0, row_i[1] = m1;
+            for (j = 0; j < 64; j++) {
+                row_j = M[s[j]];
+                if (row_j != row_i && (row_j[0] & mask)) {
+                    row_j[0] ^= row_i[0];
+                    row_j[1] ^= row_i[1];
+                }
+            }
+            s[dim++] = s[i];
+            continue;
+        }
+
+        for (j = i; j < 64 && !(M[s[j]][1] & mask); j++)
+            ;
+        if (j == 64)
+            return 0;
+        row_j = M[s[j]];
+        m0 = row_j[0], m1 = row_j[1];
+        row_j[0] = row_i[0], row_j[1] = row_i[1];
+        row_i[0] = m0, row_i[1] = m1;
+        for (j = 0; j < 64; j++) {
+            row_j = M[s[j]];
+            if (row_j != row_i && (row_j[1] & mask)) {
+                row_j[0] ^= row_i[0];
+                row_j[1] ^= row_i[1];
+            }
+        }
+        row_i[0] = row_i[1] = 0;
+    }
+    for (i = 0; i < 64; i++)
+        winv[i] = M[i][1];
+
+    // The recurrence needs every column in this block or the previous one
+    mask = 0;
+    for (i = 0; i < dim; i++)
+        mask |= (uint64_t)1 << s[i];
+    for (i = 0; i < prev_dim; i++)
+        mask |= (uint64_t)1 << prev[i];
+    return mask == ~(uint64_t)0 ? dim : 0;
+}
+
+/* Turns the output of block Lanczos into a solution. Every column of Z = X - Y and of
+   the last block V is annihilated by B^T B, up to combinations; the combinations u with
+   B [Z | V] u = 0 are found from an echelon basis of the 128-bit rows of B [Z | V]. A
+   null vector of B whose last coordinate, the right-hand side, is 1 gives a solution.
+   Returns 0 if one was found and stored in y. */
+static int
+lanczos_finish(sparse_matrix_t const *B, uint64_t const *Z, uint64_t const *V, word *y)
+{
+    uint64_t basis[128][2], a, b, u[2];
+    uint8_t pivot[128] = { 0 };
+    Py_ssize_t r, k, n = B->ncols - 1;
+    int p, q, f;
+
+    for (r = 0; r < B->nrows; r++) {
+        a = b = 0;
+        for (k = B->rowptr[r]; k < B->rowptr[r + 1]; k++) {
+            a ^= Z[B->rowidx[k]];
+            b ^= V[B->rowidx[k]];
+        }
+        while (a != 0 || b != 0) {
+            p = a != 0 ? __builtin_ctzll(a) : 64 + __builtin_ctzll(b);
+            if (!pivot[p]) {
+                basis[p][0] = a;
+                basis[p][1] = b;
+                pivot[p] = 1;
+                break;
+            }
+            a ^= basis[p][0];
+            b ^= basis[p][1];
+        }
+    }
+
+    // Reduce the basis fully, so that a free column f pairs with the pivots holding it
+    for (p = 128; p--; ) {
+        if (!pivot[p])
+            continue;
+        for (q = 0; q < p; q++) {
+            if (pivot[q] && ((basis[q][p / 64] >> (p % 64)) & 1)) {
+                basis[q][0] ^= basis[p][0];
+                basis[q][1] ^= basis[p][1];
+            }
+        }
+    }
+
+    for (f = 0; f < 128; f++) {
+        if (pivot[f])
+            continue;
+        u[0] = u[1] = 0;
+        u[f / 64] |= (uint64_t)1 << (f % 64);
+        for (p = 0; p < 128; p++)
+            if (pivot[p] && ((basis[p][f / 64] >> (f % 64)) & 1))
+                u[p / 64] |= (uint64_t)1 << (p % 64);
+        if (!(__builtin_popcountll((Z[n] & u[0]) ^ (V[n] & u[1])) & 1))
+            continue;
+
+        for (k = 0; k < n; k++)
+            if (__builtin_popcountll((Z[k] & u[0]) ^ (V[k] & u[1])) & 1)
+                y[k / m4ri_radix] |= m4ri_one << (k % m4ri_radix);
+        return 0;
+    }
+    return -1;
+}
+
+/* Solves B x = b with Montgomery's block Lanczos on B^T B, where the right-hand side is
+   the last column of B, 64 vectors at a time. Stores the solution in y, which must be
+   zeroed. Returns -1 if no solution was found, either because there is none or because
+   the iteration broke down, and -2 if memory ran out. */
+static int
+lanczos_solve(sparse_matrix_t const *B, word *y, uint64_t seed)
+{
+    uint64_t winv[3][64] = { { 0 } }, vav[2][64] = { { 0 } }, va2v[2][64] = { { 0 } };
+    uint64_t d[64], e[64], f[64], f2[64], mask0, mask1 = ~(uint64_t)0, any;
+    uint64_t *mem, *x, *v[3], *vnext, *v0, *tmp, *swap;
+    Py_ssize_t n = B->ncols, i, iter, maxiter;
+    int s[2][64], dim0, dim1 = 64, result = -1;
+
+    mem = (uint64_t *)PyMem_RawCalloc(6 * n + B->nrows, sizeof(uint64_t));
+    if (mem == NULL)
+        return -2;
+    x = mem;
+    v[0] = x + n;
+    v[1] = v[0] + n;
+    v[2] = v[1] + n;
+    vnext = v[2] + n;
+    v0 = vnext + n;
+    tmp = v0 + n;
+    for (i = 0; i < 64; i++)
+        s[1][i] = (int)i;
+
+    // Solve B^T B X = B^T B Y for a random Y, which starts out in x so that x ends up
+    // holding X - Y
+    for (i = 0; i < n; i++)
+        x[i] = splitmix64(&seed);
+    lanczos_mul(B, x, v[0], tmp);
+    memcpy(v0, v[0], n * sizeof(uint64_t));
+
+    // Each iteration gains close to 64 dimensions
+    maxiter = n / 60 + 64;
+    for (iter = 0; iter < maxiter; iter++) {
+        lanczos_mul(B, v[0], vnext, tmp);
+        lanczos_inner(v[0], vnext, n, vav[0]);
+        lanczos_inner(vnext, vnext, n, va2v[0]);
+        for (i = any = 0; i < 64; i++)
+            any |= vav[0][i];
+        if (any == 0)
+            break;
+
+        // Near the end of the Krylov space the block can stop being invertible. What
+        // has been found up to there usually still yields a solution.
+        dim0 = lanczos_select(vav[0], s[0], s[1], dim1, winv[0]);
+        if (dim0 == 0)
+            break;
+        for (i = mask0 = 0; i < dim0; i++)
+            mask0 |= (uint64_t)1 << s[0][i];
+
+        // D = I - Winv_i (V_i^T A^2 V_i S_i S_i^T + V_i^T A V_i)
+        for (i = 0; i < 64; i++)
+            d[i] = (va2v[0][i] & mask0) ^ vav[0][i];
+        lanczos_mat_mul(winv[0], d, d);
+        for (i = 0; i < 64; i++)
+            d[i] ^= (uint64_t)1 << i;
+
+        // E = Winv_{i-1} V_i^T A V_i S_i S_i^T
+        lanczos_mat_mul(winv[1], vav[0], e);
+        for (i = 0; i < 64; i++)
+            e[i] &= mask0;
+
+        // F = Winv_{i-2} (I - V_{i-1}^T A V_{i-1} Winv_{i-1})
+        //     (V_{i-1}^T A^2 V_{i-1} S_{i-1} S_{i-1}^T + V_{i-1}^T A V_{i-1}) S_i S_i^T
+        lanczos_mat_mul(vav[1], winv[1], f);
+        for (i = 0; i < 64; i++)
+            f[i] ^= (uint64_t)1 << i;
+        lanczos_mat_mul(winv[2], f, f);
+        for (i = 0; i < 64; i++)
+            f2[i] = ((va2v[1][i] & mask1) ^ vav[1][i]) & mask0;
+        lanczos_mat_mul(f, f2, f);
+
+        // V_{i+1} = A V_i S_i S_i^T + V_i D + V_{i-1} E + V_{i-2} F
+        for (i = 0; i < n; i++)
+            vnext[i] &= mask0;
+        lanczos_mul_acc(v[0], d, n, vnext);
+        lanczos_mul_acc(v[1], e, n, vnext);
+        lanczos_mul_acc(v[2], f, n, vnext);
+
+        // X += V_i Winv_i V_i^T V_0
+        lanczos_inner(v[0], v0, n, d);
+        lanczos_mat_mul(winv[0], d, d);
+        lanczos_mul_acc(v[0], d, n, x);
+
+        swap = v[2], v[2] = v[1], v[1] = v[0], v[0] = vnext, vnext = swap;
+        memcpy(winv[2], winv[1], sizeof(winv[0]));
+        memcpy(winv[1], winv[0], sizeof(winv[0]));
+        memcpy(vav[1], vav[0], sizeof(vav[0]));
+        memcpy(va2v[1], va2v[0], sizeof(va2v[0]));
+        memcpy(s[1], s[0], sizeof(s[0]));
+        mask1 = mask0;
+        dim1 = dim0;
+    }
+    if (iter < maxiter)
+        result = lanczos_finish(B, x, v[0], y);
+    PyMem_RawFree(mem);
+    return result;
+}
+
+/* Builds T = [B^T | e], whose right-hand side is 1 only in the row of the right-hand
+   side of B. A solution w of T has w^T A = 0 and w^T b = 1 for B = [A | b], which proves
+   that B has none. Returns -1 if memory ran out. */
+static int
+lanczos_transpose(sparse_matrix_t const *B, sparse_matrix_t *T)
+{
+    Py_ssize_t nnz = B->rowptr[B->nrows];
+
+    T->nrows = B->ncols;
+    T->ncols = B->nrows + 1;
+    T->rowptr = (Py_ssize_t *)PyMem_RawMalloc((T->nrows + 1) * sizeof(Py_ssize_t));
+    T->colptr = (Py_ssize_t *)PyMem_RawMalloc((T->ncols + 1) * sizeof(Py_ssize_t));
+    T->rowidx = (rci_t *)PyMem_RawMalloc((nnz + 1) * sizeof(rci_t));
+    T->colidx = (rci_t *)PyMem_RawMalloc((nnz + 1) * sizeof(rci_t));
+    if (T->rowptr == NULL || T->colptr == NULL || T->rowidx == NULL || T->colidx == NULL)
+        return -1;
+
+    // The rows of T are the columns of B, with the extra entry at the very end
+    memcpy(T->rowptr, B->colptr, T->nrows * sizeof(Py_ssize_t));
+    T->rowptr[T->nrows] = nnz + 1;
+    memcpy(T->rowidx, B->colidx, nnz * sizeof(rci_t));
+    T->rowidx[nnz] = B->nrows;
+    memcpy(T->colptr, B->rowptr, T->ncols * sizeof(Py_ssize_t));
+    T->colptr[T->ncols] = nnz + 1;
+    memcpy(T->colidx, B->rowidx, nnz * sizeof(rci_t));
+    T->colidx[nnz] = B->ncols - 1;
+    return 0;
+}
+
+/* Solves the core left by structured elimination into x: densely through
+   solve_augmented() if it is small enough, and with block Lanczos otherwise. Returns -1
+   if it has no solution and LANCZOS_GAVE_UP if block Lanczos could neither find a
+   solution nor prove that there is none. */
+static int
+sparse_solve_core(sparse_t *s, word *x, int workers)
+{
+    sparse_matrix_t B = { 0 }, T = { 0 };
+    rci_t *colmap = NULL, *core = NULL, n = 0, m = 0, r, c, k, j;
+    Py_ssize_t nnz = 0, p;
+    uint8_t homogeneous = 1;
+    mzd_t *E, *y;
+    word *z = NULL, *w = NULL;
+    int err = 0, attempt;
+
+    colmap = (rci_t *)PyMem_RawMalloc(Py_MAX(s->cols, 1) * sizeof(rci_t));
+    core = (rci_t *)PyMem_RawMalloc(Py_MAX(s->cols, 1) * sizeof(rci_t));
+    if (colmap == NULL || core == NULL)
+        goto nomem;
+    for (c = 0; c < s->cols; c++) {
+        colmap[c] = s->weight[c] > 0 ? n : -1;
+        if (s->weight[c] > 0)
+            core[n++] = c;
+    }
+    for (r = 0; r < s->rows; r++) {
+        if (s->state[r] != SPARSE_ACTIVE)
+            continue;
+        m++;
+        nnz += s->row[r].len + s->rhs[r];
+        homogeneous &= !s->rhs[r];
+    }
+    // With every right-hand side 0, all zeros is a solution
+    if (m == 0 || homogeneous)
+        goto done;
+
+    if (n < SPARSE_LANCZOS_MIN_COLS ||
+        (n <= SPARSE_DENSE_MAX_COLS && (double)m * (n + 1) <= SPARSE_DENSE_MAX_BITS)) {
+        E = mzd_init(m, n + 1);
+        y = mzd_init(1, n);
+        for (r = k = 0; r < s->rows; r++) {
+            if (s->state[r] != SPARSE_ACTIVE)
+                continue;
+            for (j = 0; j < s->row[r].len; j++)
+                mzd_write_bit(E, k, colmap[s->row[r].items[j]], 1);
+            mzd_write_bit(E, k++, n, s->rhs[r]);
+        }
+        err = solve_augmented(E, y, NULL, workers);
+        for (c = 0; c < n && err == 0; c++)
+            if (mzd_read_bit(y, 0, c))
+                x[core[c] / m4ri_radix] |= m4ri_one << (core[c] % m4ri_radix);
+        mzd_free(E);
+        mzd_free(y);
+        goto done;
+    }
+
+    B.nrows = m;
+    B.ncols = n + 1;
+    B.rowptr = (Py_ssize_t *)PyMem_RawMalloc((m + 1) * sizeof(Py_ssize_t));
+    B.colptr = (Py_ssize_t *)PyMem_RawCalloc(n + 2, sizeof(Py_ssize_t));
+    B.rowidx = (rci_t *)PyMem_RawMalloc(nnz * sizeof(rci_t));
+    B.colidx = (rci_t *)PyMem_RawMalloc(nnz * sizeof(rci_t));
+    z = (word *)PyMem_RawCalloc(n / m4ri_radix + 1, sizeof(word));
+    if (B.rowptr == NULL || B.colptr == NULL || B.rowidx == NULL || B.colidx == NULL ||
+        z == NULL)
+        goto nomem;
+    for (r = k = 0, p = 0; r < s->rows; r++) {
+        if (s->state[r] != SPARSE_ACTIVE)
+            continue;
+        B.rowptr[k++] = p;
+        for (j = 0; j < s->row[r].len; j++)
+            B.rowidx[p++] = colmap[s->row[r].items[j]];
+        if (s->rhs[r])
+            B.rowidx[p++] = n;
+    }
+    B.rowptr[m] = p;
+    for (p = 0; p < nnz; p++)
+        B.colptr[B.rowidx[p] + 1]++;
+    for (c = 0; c <= n; c++)
+        B.colptr[c + 1] += B.colptr[c];
+    for (r = 0; r < m; r++)
+        for (p = B.rowptr[r]; p < B.rowptr[r + 1]; p++)
+            B.colidx[B.colptr[B.rowidx[p]]++] = r;
+    for (c = n + 1; c > 0; c--)
+        B.colptr[c] = B.colptr[c - 1];
+    B.colptr[0] = 0;
+
+    for (attempt = 0; attempt < LANCZOS_ATTEMPTS; attempt++) {
+        err = lanczos_solve(&B, z, 0x786f72736174ull + attempt);
+        if (err != -1)
+            break;
+    }
+    if (err == -2)
+        goto nomem;
+
+    // Lanczos cannot tell a breakdown from a system without a solution, so look for a
+    // combination of the equations that reads 0 = 1 instead
+    if (err == -1) {
+        if (lanczos_transpose(&B, &T) < 0)
+            goto nomem;
+        w = (word *)PyMem_RawCalloc(m / m4ri_radix + 1, sizeof(word));
+        if (w == NULL)
+            goto nomem;
+        for (attempt = 0; attempt < LANCZOS_ATTEMPTS; attempt++) {
+            err = lanczos_solve(&T, w, 0x786f72736174ull + attempt);
+            if (err != -1)
+                break;
+        }
+        if (err == -2)
+            goto nomem;
+        err = err == 0 ? -1 : LANCZOS_GAVE_UP;
+        goto done;
+    }
+    for (c = 0; c < n && err == 0; c++)
+        if ((z[c / m4ri_radix] >> (c % m4ri_radix)) & 1)
+            x[core[c] / m4ri_radix] |= m4ri_one << (core[c] % m4ri_radix);
+    goto done;
+
+nomem:
+    s->nomem = 1;
+done:
+    PyMem_RawFree(colmap);
+    PyMem_RawFree(core);
+    PyMem_RawFree(B.rowptr);
+    PyMem_RawFree(B.colptr);
+    PyMem_RawFree(B.rowidx);
+    PyMem_RawFree(B.colidx);
+    PyMem_RawFree(T.rowptr);
+    PyMem_RawFree(T.colptr);
+    PyMem_RawFree(T.rowidx);
+    PyMem_RawFree(T.colidx);
+    PyMem_RawFree(z);
+    PyMem_RawFree(w);
+    return err;
+}
+
+/* Solves the equations of solve_zeros() without ever building the dense matrix: rows
+   are kept as lists of columns, reduced by structured elimination, and the core is
+   handed to sparse_solve_core(). Items have already been validated. */
+static PyObject *
+solve_sparse(LinearSystemObject *system, PyObject **items, Py_ssize_t size, rci_t rows,
+             model_format_t format, int threads)
+{
+    sparse_t s = { 0 };
+    PyObject *result = NULL;
+    mzd_t *x;
+    int err, prev, workers;
+
+    if (sparse_init(&s, system, items, size, rows) < 0) {
+        sparse_free(&s);
+        return NULL;
+    }
+    workers = threads > 0 ? threads : cpu_count();
+
+    x = mzd_init(1, s.cols);
+    Py_BEGIN_ALLOW_THREADS
+    prev = set_num_threads(threads);
+    err = sparse_reduce(&s);
+    if (err == 0 && !s.nomem)
+        err = sparse_solve_core(&s, mzd_row(x, 0), workers);
+    if (err == 0 && !s.nomem)
+        sparse_expand(&s, mzd_row(x, 0));
+    set_num_threads(prev);
+    Py_END_ALLOW_THREADS
+
+    if (s.nomem)
+        PyErr_NoMemory();
+    else if (err == LANCZOS_GAVE_UP)
+        PyErr_SetString(PyExc_RuntimeError,
+            "block Lanczos broke down; solve with method='dense' instead");
+    else if (err < 0)
+        PyErr_SetString(PyExc_ValueError, "no solution");
+    else
+        result = generate_model(x, system, format);
+    mzd_free(x);
+    sparse_free(&s);
+    return result;
+}
+
+/* Whether method='auto' should pick the sparse engine for these equations */
+static int
+sparse_preferred(LinearSystemObject *system, PyObject **items, Py_ssize_t size,
+                 rci_t rows)
+{
+    BitMatrixObject *block;
+    double nnz = 0;
+    Py_ssize_t i, j;
+    wi_t k;
+
+    if (system->bits < SPARSE_MIN_COLS)
+        return 0;
+    for (i = 0; i < size; i++) {
+        if (BitExpr_Check(items[i])) {
+            nnz += bitset_count_impl((BitSetObject *)((BitExprObject *)items[i])->mask);
+            continue;
+        }
+        block = (BitMatrixObject *)items[i];
+        for (j = 0; j < block->M->nrows; j++)
+            for (k = 0; k < block->M->width; k++)
+                nnz += __builtin_popcountll(mzd_row(block->M, (rci_t)j)[k]);
+    }
+    return nnz * SPARSE_MIN_RATIO <= (double)rows * system->bits;
+}
+
+/* =============================== Streaming ================================ */
+
+/* Rows are written to the spill file through a buffer of about this many bytes. */
+#define SPILL_BUFFER_BYTES (1 << 20)
+
+/* Unless chunk= says otherwise, spilled rows are merged into the basis in blocks of about
+   this many bytes, of SOLVER_BLOCK_ROWS to SOLVER_FLUSH_ROWS rows */
+#define SPILL_MERGE_BYTES (1 << 22)
+
+/* Moves the reader on to its next item and checks it. Leaves item NULL at the end. */
+static int
+row_reader_advance(row_reader_t *rd)
+{
+    PyObject *item;
+    BitExprObject *expr;
+    mzd_t *M;
+
+    Py_CLEAR(rd->item);
+    rd->next = 0;
+    item = PyIter_Next(rd->iter);
+    if (item == NULL)
+        return PyErr_Occurred() ? -1 : 0;
+
+    if (BitExpr_Check(item)) {
+        expr = (BitExprObject *)item;
+        if (rd->system == NULL)
+            rd->system = Py_NewRef(expr->system);
+        if (!Py_Is(expr->system, rd->system)) {
+            PyErr_SetString(PyExc_TypeError,
+                "iterable cannot contain differing linear systems");
+            goto error;
+        }
+    } else if (PyObject_TypeCheck(item, &BitMatrix_Type)) {
+        if (rd->system == NULL) {
+            PyErr_SetString(PyExc_TypeError,
+                "system must be given when the first item is a BitMatrix");
+            goto error;
+        }
+        M = ((BitMatrixObject *)item)->M;
+        if (M->ncols != ((LinearSystemObject *)rd->system)->bits + 1) {
+            PyErr_Format(PyExc_ValueError, "expected a matrix with %zd columns, got %d",
+                         ((LinearSystemObject *)rd->system)->bits + 1, M->ncols);
+            goto error;
+        }
+    } else {
+        PyErr_Format(PyExc_TypeError, "expected iterable of BitExprs, got: '%.200s'",
+                     Py_TYPE(item)->tp_name);
+        goto error;
+    }
+    rd->item = item;
+    return 0;
+
+error:
+    Py_DECREF(item);
+    return -1;
+}
+
+static void
+row_reader_free(row_reader_t *rd)
+{
+    Py_CLEAR(rd->iter);
+    Py_CLEAR(rd->system);
+    Py_CLEAR(rd->item);
+}
+
+/* Starts reading the equations of solve_zeros() from an iterable. The first item is
+   fetched right away, so that the system, and with it the row width, is known. */
+static int
+row_reader_init(row_reader_t *rd, PyObject *iterable, LinearSystemObject *system)
+{
+    rd->system = (PyObject *)system;
+    Py_XINCREF(rd->system);
+    rd->item = NULL;
+    rd->nrows = 0;
+    rd->iter = PyObject_GetIter(iterable);
+    if (rd->iter == NULL || row_reader_advance(rd) < 0)
+        return -1;
+    if (rd->system == NULL) {
+        PyErr_SetString(PyExc_TypeError,
+            "system must be given when no BitExprs are passed");
+        return -1;
+    }
+    if (((LinearSystemObject *)rd->system)->bits >= INT_MAX - 1) {
+        PyErr_SetString(PyExc_OverflowError, "number of bits in system must be <2^31-1");
+        return -1;
+    }
+    return 0;
+}
+
+/* Reads the next augmented row, `width` words, into row. Returns 1 if there was one, 0
+   at the end and -1 on error. */
+static int
+row_reader_next(row_reader_t *rd, word *row, wi_t width)
+{
+    Py_ssize_t cols = ((LinearSystemObject *)rd->system)->bits;
+    BitExprObject *expr;
+    mzd_t *M;
+
+    while (rd->item != NULL) {
+        if (BitExpr_Check(rd->item)) {
+            expr = (BitExprObject *)rd->item;
+            memset(row, 0, width * sizeof(word));
+            bitset_xor_into((BitSetObject *)expr->mask, row);
+            if (expr->compl)
+                row[cols / m4ri_radix] ^= m4ri_one << (cols % m4ri_radix);
+            if (row_reader_advance(rd) < 0)
+                return -1;
+            goto found;
+        }
+        M = ((BitMatrixObject *)rd->item)->M;
+        if (rd->next < M->nrows) {
+            memcpy(row, mzd_row(M, rd->next++), width * sizeof(word));
+            goto found;
+        }
+        if (row_reader_advance(rd) < 0)
+            return -1;
+    }
+    return 0;
+
+found:
+    if (++rd->nrows >= INT_MAX) {
+        PyErr_SetString(PyExc_OverflowError, "number of equations must be <2^31");
+        return -1;
+    }
+    return 1;
+}
+
+/* Writes all of buf to fd, or returns -1 with errno set. */
+static int
+spill_write(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Creates an anonymous scratch file in dir. It is unlinked right away, so it goes away
+   with the descriptor even if the process dies. */
+static int
+spill_open(const char *dir)
+{
+    char *path;
+    size_t len = strlen(dir) + sizeof("/xorsat-XXXXXX");
+    int fd;
+
+    path = (char *)PyMem_Malloc(len);
+    if (path == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    PyOS_snprintf(path, len, "%s/xorsat-XXXXXX", dir);
+    fd = mkstemp(path);
+    if (fd < 0)
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    else
+        unlink(path);
+    PyMem_Free(path);
+    return fd;
+}
+
+/* Solves the equations of solve_zeros() while holding only a reduced basis and one
+   chunk of rows: the rows are read from the iterable `chunk` at a time, merged into the
+   basis of a Solver, and those that reduce to zero are dropped. With dir set, the rows
+   are first streamed into a packed scratch file there and read back through a mapping
+   of it. A chunk of 0 means about SPILL_MERGE_BYTES. Either way the store holds at most
+   a full basis and one chunk. */
+static PyObject *
+solve_streamed(PyObject *iterable, LinearSystemObject *system, const char *dir,
+               Py_ssize_t chunk, int all, model_format_t format, int threads)
+{
+    row_reader_t rd;
+    SolverObject *solver = NULL;
+    PyObject *result = NULL;
+    Py_ssize_t rows = 0, n, r, k, bufrows;
+    size_t rowbytes, bytes = 0, page, consumed;
+    word *buf = NULL, *map = MAP_FAILED;
+    rci_t cols;
+    wi_t width;
+    int fd = -1, err, rc = 0;
+
+    if (row_reader_init(&rd, iterable, system) < 0)
+        goto done;
+    cols = (rci_t)((LinearSystemObject *)rd.system)->bits;
+    width = (cols + m4ri_radix) / m4ri_radix;
+    rowbytes = width * sizeof(word);
+    if (chunk == 0)
+        chunk = Py_MAX(SOLVER_BLOCK_ROWS,
+                       Py_MIN(SOLVER_FLUSH_ROWS, SPILL_MERGE_BYTES / (Py_ssize_t)rowbytes));
+    // Merging more rows at once than a basis can have saves no work
+    chunk = Py_MIN(chunk, Py_MAX((Py_ssize_t)cols + 1, SOLVER_FLUSH_ROWS));
+
+    solver = (SolverObject *)PyObject_CallNoArgs((PyObject *)&Solver_Type);
+    if (solver == NULL || solver_bind(solver, rd.system) < 0)
+        goto done;
+
+    if (dir == NULL) {
+        // Merge the rows straight from the iterable, stopping at a contradiction. The
+        // basis never has more rows than variables, so the store is sized once.
+        if (solver_reserve(solver, cols + chunk) < 0)
+            goto done;
+        while (!solver->inconsistent) {
+            for (k = 0; k < chunk; k++) {
+                rc = row_reader_next(&rd, solver_push_row(solver), width);
+                if (rc <= 0) {
+                    solver->nrows--;
+                    break;
+                }
+            }
+            if (rc < 0 || solver_flush(solver, threads) < 0)
+                goto done;
+            if (rc == 0)
+                break;
+        }
+        rows = rd.nrows;
+        goto solve;
+    }
+
+    fd = spill_open(dir);
+    if (fd < 0)
+        goto done;
+
+    // Stream the rows out
+    bufrows = Py_MAX(1, SPILL_BUFFER_BYTES / (Py_ssize_t)rowbytes);
+    buf = (word *)PyMem_Malloc(bufrows * rowbytes);
+    if (buf == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    do {
+        for (n = 0; n < bufrows; n++) {
+            rc = row_reader_next(&rd, buf + n * width, width);
+            if (rc < 0)
+                goto done;
+            if (rc == 0)
+                break;
+        }
+        Py_BEGIN_ALLOW_THREADS
+        err = spill_write(fd, (const char *)buf, n * rowbytes);
+        Py_END_ALLOW_THREADS
+        if (err < 0) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            goto done;
+        }
+    } while (rc == 1);
+    PyMem_Free(buf);
+    buf = NULL;
+
+    rows = rd.nrows;
+    if (rows == 0)
+        goto solve;
+    bytes = rows * rowbytes;
+    map = (word *)mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto done;
+    }
+    madvise(map, bytes, MADV_SEQUENTIAL);
+
+    // Merge them into the basis, which needs room for at most a full basis and one chunk
+    if (solver_reserve(solver, Py_MIN(rows, cols + chunk)) < 0)
+        goto done;
+    page = (size_t)sysconf(_SC_PAGESIZE);
+    for (r = 0; r < rows && !solver->inconsistent; r += n) {
+        n = Py_MIN(chunk, rows - r);
+        for (k = 0; k < n; k++)
+            memcpy(solver_push_row(solver), map + (r + k) * width, rowbytes);
+
+        // The pages that were read completely are not needed again
+        consumed = (r + n) * rowbytes / page * page;
+        madvise(map, consumed, MADV_DONTNEED);
+
+        if (solver_flush(solver, threads) < 0)
+            goto done;
+    }
+
+solve:
+    if (rows == 0) {
+        PyErr_SetString(PyExc_ValueError, "argument must contain at least one equation");
+        goto done;
+    }
+    if (solver->inconsistent) {
+        PyErr_SetString(PyExc_ValueError, "no solution");
+        goto done;
+    }
+    solver->busy = 1;
+    result = solve_echelon((LinearSystemObject *)solver->system, solver->rows, solver->rank,
+                           all, format, threads);
+    solver->busy = 0;
+
+done:
+    if (map != MAP_FAILED)
+        munmap(map, bytes);
+    if (fd >= 0)
+        close(fd);
+    PyMem_Free(buf);
+    Py_XDECREF(solver);
+    row_reader_free(&rd);
+    return result;
+}
+
+/* =========================== Module definitions =========================== */
+
+static PyObject *
+xorsat_lshr(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!_PyArg_CheckPositional("LShR", nargs, 2, 2))
+        return NULL;
+    return bitvec_shift(args[0], args[1], SHIFT_SHR);
+}
+
+static PyObject *
+xorsat_rotl(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!_PyArg_CheckPositional("RotL", nargs, 2, 2))
+        return NULL;
+    return bitvec_shift(args[0], args[1], SHIFT_ROL);
+}
+
+static PyObject *
+xorsat_rotr(PyObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!_PyArg_CheckPositional("RotR", nargs, 2, 2))
+        return NULL;
+    return bitvec_shift(args[0], args[1], SHIFT_ROR);
+}
+
+static PyObject *
+xorsat_par(PyObject *self, PyObject *arg)
+{
+    LinearSystemObject *system;
+    BitVecObject *vec, *result;
+    BitExprObject *expr, *acc;
+    Py_ssize_t size, i;
+    bitset_t *words;
+
+    if (!BitVec_Check(arg)) {
+        PyErr_SetString(PyExc_TypeError, "argument must be a BitVec");
+        return NULL;
+    }
+
+    vec = (BitVecObject *)arg;
+    system = (LinearSystemObject *)vec->system;
+    size = Py_SIZE(vec);
+    if (vec->M != NULL) {
+        result = (BitVecObject *)bitvec_from_matrix(&BitVec_Type, size, vec->system);
+        if (result == NULL)
+            return NULL;
+        for (i = 0; i < size; i++)
+            bitvec_xor_row(result->M, 0, mzd_row(vec->M, i));
+        return (PyObject *)result;
+    }
+
+    result = (BitVecObject *)bitvec_from_size(&BitVec_Type, size, vec->system, 1);
+    if (result == NULL)
+        return NULL;
 
-    for (i = 0; i < system->vi_size; i++) {
-        var = (VarInfoObject *)system->vi_table[i];
-        num = PyLong_FromLong(0);
-        if (num == NULL)
-            goto error;
-        for (b = var->offset + var->bits - 1; b >= var->offset; b--) {
-            num = PyNumber_Lshift(num, one);
-            bit = PyLong_FromLong(mzd_read_bit(x, 0, b));
-            if (bit == NULL)
-                goto error;
-            num = PyNumber_Or(num, bit);
-            Py_DECREF(bit);
+    acc = (BitExprObject *)bitexpr_from_bit(&BitExpr_Type, 0, system);
+    words = PyMem_Calloc(BS_SIZE(system->bits) + 1, sizeof(bitset_t));
+    if (acc == NULL || words == NULL) {
+        Py_XDECREF(acc);
+        Py_DECREF(result);
+        PyMem_Free(words);
+        return words == NULL ? PyErr_NoMemory() : NULL;
+    }
+
+    // Accumulate densely, then store the sum in whichever form fits
+    for (i = 0; i < size; i++) {
+        expr = (BitExprObject *)vec->exprs[i];
+        bitset_xor_into((BitSetObject *)expr->mask, words);
+        acc->compl ^= expr->compl;
+    }
+    Py_SETREF(acc->mask, bitset_from_words(&BitSet_Type, system->bits, words));
+    PyMem_Free(words);
+    if (acc->mask == NULL) {
+        Py_DECREF(acc);
+        Py_DECREF(result);
+        return NULL;
+    }
+    Py_SETREF(result->exprs[0], (PyObject *)acc);
+    return (PyObject *)result;
+}
+
+static PyObject *
+xorsat_broadcast(PyObject *self, PyObject *args)
+{
+    BitVecObject *vec, *result;
+    Py_ssize_t index = 0, size, i;
+
+    if (!PyArg_ParseTuple(args, "O!|n", &BitVec_Type, &vec, &index))
+        return NULL;
+    size = Py_SIZE(vec);
+    if (index < 0 || index >= size) {
+        PyErr_SetString(PyExc_IndexError, "index out of range");
+        return NULL;
+    }
+
+    if (vec->M != NULL) {
+        result = (BitVecObject *)bitvec_from_matrix(&BitVec_Type, size, vec->system);
+        if (result == NULL)
+            return NULL;
+        for (i = 0; i < size; i++) {
+            memcpy(mzd_row(result->M, i), mzd_row(vec->M, index),
+                   vec->M->width * sizeof(word));
+            result->exprs[i] = Py_XNewRef(vec->exprs[index]);
         }
-        if (PyDict_SetItem(result, var->name, num) < 0)
-            goto error;
-        Py_DECREF(num);
+        return (PyObject *)result;
     }
 
-    Py_DECREF(one);
-    return result;
+    result = (BitVecObject *)bitvec_from_size(&BitVec_Type, size, vec->system, 0);
+    if (result == NULL)
+        return NULL;
 
-error:
-    Py_DECREF(result);
-    Py_XDECREF(one);
-    Py_XDECREF(num);
-    Py_XDECREF(bit);
-    return NULL;
+    for (i = 0; i < size; i++)
+        result->exprs[i] = Py_NewRef(vec->exprs[index]);
+    return (PyObject *)result;
 }
 
 static PyObject *
-xorsat__solve_zeros(PyObject *self, PyObject *args, PyObject *kwds)
+xorsat_stack_masks(PyObject *self, PyObject *arg)
 {
-    // Gaussian elimination algorithm based on:
-    // https://github.com/nneonneo/pwn-stuff/blob/main/math/gf2.py
-
-    static char *kwlist[] = { "", "all", NULL };
     LinearSystemObject *system;
-    BitExprObject *expr, *expr2;
+    BitExprObject *expr;
     BitSetObject *mask;
-    SolveIterObject *it = NULL;
-    PyObject *constraints, **items, *seq = NULL;
-    PyObject *model;
+    PyObject *seq, **items;
     Py_ssize_t size, i;
-    rci_t rows, cols, r, c, *leads;
-    mzd_t *M = NULL, *x = NULL, *window, *kernel, *kernel_trans = NULL;
-    int all = 0, dot;
-
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|p", kwlist, &constraints, &all))
-        return NULL;
+    mzd_t *M;
 
-    seq = PySequence_Fast(constraints, "argument is not iterable");
+    seq = PySequence_Fast(arg, "argument is not iterable");
     if (seq == NULL)
         return NULL;
 
     size = PySequence_Fast_GET_SIZE(seq);
     if (size == 0) {
-        PyErr_SetString(PyExc_ValueError, "argument must contain at least one equation");
+        PyErr_SetString(PyExc_ValueError, "iterable cannot be empty");
         goto error;
     }
     if (size >= INT_MAX) {
-        PyErr_SetString(PyExc_OverflowError, "number of equations must be <2^31");
+        PyErr_SetString(PyExc_OverflowError, "number of masks must be <2^31-1");
         goto error;
     }
 
@@ -1616,129 +6648,496 @@ xorsat__solve_zeros(PyObject *self, PyObject *args, PyObject *kwds)
                 Py_TYPE(items[i])->tp_name);
             goto error;
         }
-    }
-
-    expr = (BitExprObject *)items[0];
-    for (i = 1; i < size; i++) {
-        expr2 = (BitExprObject *)items[i];
-        if (!Py_Is(expr->system, expr2->system)) {
+        if (!Py_Is(((BitExprObject *)items[i])->system,
+                   ((BitExprObject *)items[0])->system)) {
             PyErr_SetString(PyExc_TypeError,
                 "iterable cannot contain differing linear systems");
             goto error;
         }
     }
 
-    system = (LinearSystemObject *)expr->system;
-    if (system->bits >= INT_MAX - 1) {
+    system = (LinearSystemObject *)((BitExprObject *)items[0])->system;
+    if (system->bits >= INT_MAX) {
         PyErr_SetString(PyExc_OverflowError, "number of bits in system must be <2^31-1");
         goto error;
     }
 
-    rows = (rci_t)size;
-    cols = (rci_t)system->bits;
-    M = mzd_init(rows, cols + 1);
-
-    for (r = 0; r < rows; r++) {
-        expr = (BitExprObject *)items[r];
+    M = mzd_init((rci_t)size, (rci_t)system->bits);
+    for (i = 0; i < size; i++) {
+        expr = (BitExprObject *)items[i];
         mask = (BitSetObject *)expr->mask;
-        memcpy(mzd_row(M, r), mask->buf, (cols + 7) / 8);
-        mzd_write_bit(M, r, cols, expr->compl);
+        bitset_xor_into(mask, mzd_row(M, i));
     }
 
-    // Reduce the augmented matrix to row echelon form (but not fully reduced)
-    mzd_echelonize(M, 0);
+    Py_DECREF(seq);
+    return bitmatrix_create(&BitMatrix_Type, M);
 
-    // Test if there is no solution (A[r] == [0 0 0 ... 0 0 0 1])
-    for (r = 0; r < rows; r++) {
-        window = mzd_init_window(M, r, 0, r + 1, cols);
-        if (mzd_is_zero(window) && mzd_read_bit(M, r, cols) == 1) {
-            PyErr_SetString(PyExc_ValueError, "no solution");
-            goto error;
-        }
-        mzd_free_window(window);
+error:
+    Py_DECREF(seq);
+    return NULL;
+}
+
+int
+model_format_converter(PyObject *arg, void *ptr)
+{
+    model_format_t *format = (model_format_t *)ptr;
+
+    if (!PyUnicode_Check(arg)) {
+        PyErr_Format(PyExc_TypeError, "format must be a str, not '%.200s'",
+            Py_TYPE(arg)->tp_name);
+        return 0;
     }
+    if (PyUnicode_CompareWithASCIIString(arg, "dict") == 0)
+        *format = MODEL_DICT;
+    else if (PyUnicode_CompareWithASCIIString(arg, "bytes") == 0)
+        *format = MODEL_BYTES;
+    else {
+        PyErr_Format(PyExc_ValueError,
+            "format must be either 'dict' or 'bytes', not '%U'", arg);
+        return 0;
+    }
+    return 1;
+}
 
-    leads = (rci_t *)PyMem_Malloc(rows * sizeof(rci_t));
-    if (leads == NULL) {
-        PyErr_NoMemory();
-        goto error;
+int
+solve_method_converter(PyObject *arg, void *ptr)
+{
+    solve_method_t *method = (solve_method_t *)ptr;
+
+    if (!PyUnicode_Check(arg)) {
+        PyErr_Format(PyExc_TypeError, "method must be a str, not '%.200s'",
+            Py_TYPE(arg)->tp_name);
+        return 0;
+    }
+    if (PyUnicode_CompareWithASCIIString(arg, "auto") == 0)
+        *method = SOLVE_AUTO;
+    else if (PyUnicode_CompareWithASCIIString(arg, "dense") == 0)
+        *method = SOLVE_DENSE;
+    else if (PyUnicode_CompareWithASCIIString(arg, "sparse") == 0)
+        *method = SOLVE_SPARSE;
+    else {
+        PyErr_Format(PyExc_ValueError,
+            "method must be 'auto', 'dense' or 'sparse', not '%U'", arg);
+        return 0;
+    }
+    return 1;
+}
+
+int
+threads_converter(PyObject *arg, void *ptr)
+{
+    int *threads = (int *)ptr;
+    long value;
+
+    value = PyLong_AsLong(arg);
+    if (value == -1 && PyErr_Occurred())
+        return 0;
+    if (value < 0 || value > INT_MAX) {
+        PyErr_SetString(PyExc_ValueError, "threads must be a non-negative int");
+        return 0;
     }
+    *threads = (int)value;
+    return 1;
+}
 
-    for (r = c = 0; r < rows; r++) {
-        while (c < cols && !mzd_read_bit(M, r, c)) ++c;
-        if (c == cols) break;
-        leads[r] = c;
+/* Copies bits [offset, offset+bits) of src into dst as a little-endian integer of
+   (bits + 7) / 8 bytes, moving a whole word per step. */
+static void
+bits_to_bytes(word const *src, Py_ssize_t offset, Py_ssize_t bits, uint8_t *dst)
+{
+    Py_ssize_t nbytes, p, end, k, j;
+    word w;
+
+    nbytes = (bits + 7) / 8;
+    end = offset + bits;
+    for (k = 0; k < nbytes; k += 8) {
+        p = offset + 8 * k;
+        w = src[p / m4ri_radix] >> (p % m4ri_radix);
+        if (p % m4ri_radix != 0 && (p / m4ri_radix + 1) * m4ri_radix < end)
+            w |= src[p / m4ri_radix + 1] << (m4ri_radix - p % m4ri_radix);
+        if (end - p < m4ri_radix)
+            w &= __M4RI_LEFT_BITMASK(end - p);
+        for (j = 0; j < 8 && k + j < nbytes; j++)
+            dst[k + j] = (uint8_t)(w >> (8 * j));
     }
+}
 
-    // Find a solution via back-substitution
-    x = mzd_init(1, cols);
-    for (; r--; ) {
-        c = leads[r];
-        if (c == -1)
-            continue;
+PyObject *
+generate_model(mzd_t *x, LinearSystemObject *system, model_format_t format)
+{
+    VarInfoObject *var;
+    PyObject *result, *num;
+    uint8_t *buf;
+    Py_ssize_t maxbits, i;
 
-        // TODO: improve speed
-        dot = 0;
-        for (i = c + 1; i < cols; i++)
-            dot ^= mzd_read_bit(M, r, i) & mzd_read_bit(x, 0, i);
+    assert(x->nrows == 1);
+
+    if (format == MODEL_BYTES) {
+        result = PyBytes_FromStringAndSize(NULL, (system->bits + 7) / 8);
+        if (result == NULL)
+            return NULL;
+        bits_to_bytes(mzd_row(x, 0), 0, system->bits,
+                      (uint8_t *)PyBytes_AS_STRING(result));
+        return result;
+    }
 
-        // x[c] = M[r,c+1:cols] * x[c+1:cols] + M[r,cols]
-        mzd_write_bit(x, 0, c, dot ^ mzd_read_bit(M, r, cols));
+    maxbits = 0;
+    for (i = 0; i < system->vi_size; i++) {
+        var = (VarInfoObject *)system->vi_table[i];
+        if (var->bits > maxbits)
+            maxbits = var->bits;
     }
+    buf = (uint8_t *)PyMem_Malloc((maxbits + 7) / 8);
+    if (buf == NULL)
+        return PyErr_NoMemory();
 
-    PyMem_Free(leads);
+    result = PyDict_New();
+    if (result == NULL)
+        goto error;
 
-    if (all) {
-        window = mzd_init_window(M, 0, 0, rows, cols);
-        kernel = mzd_kernel_left_pluq(window, 0);
-        if (kernel != NULL) {
-            kernel_trans = mzd_transpose(NULL, kernel);
-            mzd_free(kernel);
-        } else {
-            kernel_trans = mzd_init(0, 0);
+    for (i = 0; i < system->vi_size; i++) {
+        var = (VarInfoObject *)system->vi_table[i];
+        bits_to_bytes(mzd_row(x, 0), var->offset, var->bits, buf);
+        num = _PyLong_FromByteArray(buf, (var->bits + 7) / 8, 1, 0);
+        if (num == NULL)
+            goto error;
+        if (PyDict_SetItem(result, var->name, num) < 0) {
+            Py_DECREF(num);
+            goto error;
+        }
+        Py_DECREF(num);
+    }
+
+    PyMem_Free(buf);
+    return result;
+
+error:
+    PyMem_Free(buf);
+    Py_XDECREF(result);
+    return NULL;
+}
+
+static PyObject *
+xorsat_solve_zeros(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    // Gaussian elimination algorithm based on:
+    // https://github.com/nneonneo/pwn-stuff/blob/main/math/gf2.py
+
+    static char *kwlist[] = { "", "all", "format", "system", "threads", "method", "spill",
+                              "chunk", NULL };
+    LinearSystemObject *system = NULL;
+    BitExprObject *expr;
+    BitMatrixObject *block;
+    BitSetObject *mask;
+    PyObject *constraints, **items, *seq = NULL, *spill = Py_None, *dir;
+    const char *tmpdir;
+    PyObject *result;
+    Py_ssize_t size, total, chunk = 0, i, j;
+    rci_t rows, cols, r;
+    mzd_t *M = NULL;
+    model_format_t format = MODEL_DICT;
+    solve_method_t method = SOLVE_AUTO;
+    int all = 0, threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|p$O&O!O&O&On", kwlist, &constraints,
+                                     &all, model_format_converter, &format,
+                                     &LinearSystem_Type, &system,
+                                     threads_converter, &threads,
+                                     solve_method_converter, &method, &spill, &chunk))
+        return NULL;
+    if (all && method == SOLVE_SPARSE) {
+        PyErr_SetString(PyExc_ValueError, "all=True is not supported with method='sparse'");
+        return NULL;
+    }
+
+    if (chunk < 0) {
+        PyErr_SetString(PyExc_ValueError, "chunk must be non-negative");
+        return NULL;
+    }
+
+    // spill is True for the default temporary directory, or the directory to use
+    if (chunk > 0 || (spill != Py_None && spill != Py_False)) {
+        if (method == SOLVE_SPARSE) {
+            PyErr_SetString(PyExc_ValueError,
+                "chunk and spill are not supported with method='sparse'");
+            return NULL;
+        }
+        if (spill == Py_None || spill == Py_False)
+            return solve_streamed(constraints, system, NULL, chunk, all, format, threads);
+        if (spill == Py_True) {
+            tmpdir = getenv("TMPDIR");
+            return solve_streamed(constraints, system, tmpdir != NULL ? tmpdir : "/tmp",
+                                  chunk, all, format, threads);
         }
-        mzd_free_window(window);
+        if (!PyUnicode_FSConverter(spill, &dir))
+            return NULL;
+        result = solve_streamed(constraints, system, PyBytes_AS_STRING(dir), chunk, all,
+                                format, threads);
+        Py_DECREF(dir);
+        return result;
+    }
+
+    seq = PySequence_Fast(constraints, "argument is not iterable");
+    if (seq == NULL)
+        return NULL;
 
-        it = PyObject_GC_New(SolveIterObject, &SolveIter_Type);
-        if (it == NULL)
+    // Each item is either a BitExpr, contributing one row, or a BitMatrix of already
+    // packed rows with the right-hand side in the last column.
+    size = PySequence_Fast_GET_SIZE(seq);
+    items = PySequence_Fast_ITEMS(seq);
+    for (i = 0; i < size; i++) {
+        if (BitExpr_Check(items[i])) {
+            expr = (BitExprObject *)items[i];
+            if (system == NULL)
+                system = (LinearSystemObject *)expr->system;
+            if (!Py_Is(expr->system, (PyObject *)system)) {
+                PyErr_SetString(PyExc_TypeError,
+                    "iterable cannot contain differing linear systems");
+                goto error;
+            }
+        } else if (!PyObject_TypeCheck(items[i], &BitMatrix_Type)) {
+            PyErr_Format(PyExc_TypeError,
+                "expected iterable of BitExprs, got: '%.200s'",
+                Py_TYPE(items[i])->tp_name);
             goto error;
+        }
+    }
+    if (system == NULL) {
+        PyErr_SetString(PyExc_TypeError,
+            "system must be given when no BitExprs are passed");
+        goto error;
+    }
+    if (system->bits >= INT_MAX - 1) {
+        PyErr_SetString(PyExc_OverflowError, "number of bits in system must be <2^31-1");
+        goto error;
+    }
 
-        it->system = Py_NewRef(system);
-        it->x = x;
-        it->kernel = kernel_trans;
-        it->state = PyMem_Calloc(1, kernel_trans->nrows + 1);
-        if (it->state == NULL) {
-            PyErr_NoMemory();
+    total = 0;
+    for (i = 0; i < size; i++) {
+        if (BitExpr_Check(items[i])) {
+            total++;
+            continue;
+        }
+        block = (BitMatrixObject *)items[i];
+        if (block->M->ncols != system->bits + 1) {
+            PyErr_Format(PyExc_ValueError,
+                "expected a matrix with %zd columns, got %d", system->bits + 1,
+                block->M->ncols);
             goto error;
         }
+        total += block->M->nrows;
+    }
+    if (total == 0) {
+        PyErr_SetString(PyExc_ValueError, "argument must contain at least one equation");
+        goto error;
+    }
+    if (total >= INT_MAX) {
+        PyErr_SetString(PyExc_OverflowError, "number of equations must be <2^31");
+        goto error;
+    }
 
+    rows = (rci_t)total;
+    cols = (rci_t)system->bits;
+    if (method == SOLVE_SPARSE ||
+        (method == SOLVE_AUTO && !all && sparse_preferred(system, items, size, rows))) {
+        result = solve_sparse(system, items, size, rows, format, threads);
         Py_DECREF(seq);
-        mzd_free(M);
-        return (PyObject *)it;
+        return result;
+    }
+    if (cols <= SMALL_MAX_COLS) {
+        result = solve_small(system, items, size, rows, all, format);
+        Py_DECREF(seq);
+        return result;
+    }
+    M = mzd_init(rows, cols + 1);
+
+    for (i = r = 0; i < size; i++) {
+        if (BitExpr_Check(items[i])) {
+            expr = (BitExprObject *)items[i];
+            mask = (BitSetObject *)expr->mask;
+            bitset_xor_into(mask, mzd_row(M, r));
+            mzd_write_bit(M, r, cols, expr->compl);
+            r++;
+            continue;
+        }
+        block = (BitMatrixObject *)items[i];
+        for (j = 0; j < block->M->nrows; j++, r++)
+            memcpy(mzd_row(M, r), mzd_row(block->M, j), M->width * sizeof(word));
     }
 
-    model = generate_model(x, system);
+    result = solve_matrix(system, M, all, format, threads);
     Py_DECREF(seq);
     mzd_free(M);
-    mzd_free(x);
-    return model;
+    return result;
 
 error:
     Py_XDECREF(seq);
-    Py_XDECREF(it);
     mzd_xfree(M);
-    mzd_xfree(x);
-    mzd_xfree(kernel_trans);
     return NULL;
 }
 
+/* Most expensive first */
+static int
+solve_task_compare(const void *a, const void *b)
+{
+    double ca = ((const solve_task_t *)a)->cost, cb = ((const solve_task_t *)b)->cost;
+
+    return (ca < cb) - (ca > cb);
+}
+
+static void
+solve_task_reduce(void *arg, Py_ssize_t i)
+{
+    solve_task_t *task = &((solve_task_t *)arg)[i];
+    SolverObject *s = task->solver;
+    int prev;
+
+    task->added = 0;
+    if (s->nrows == s->rank)
+        return;
+    prev = set_num_threads(task->threads);
+    solver_reduce_pending(s, s->nrows, &task->added);
+    set_num_threads(prev);
+}
+
+static void
+solve_task_finish(void *arg, Py_ssize_t i)
+{
+    solve_task_t *task = &((solve_task_t *)arg)[i];
+    SolverObject *s = task->solver;
+    int prev;
+
+    prev = set_num_threads(task->threads);
+    solver_extend_basis(s, s->nrows, task->added);
+    if (!s->inconsistent) {
+        task->x = mzd_init(1, s->rows->ncols - 1);
+        echelon_solve(s->rows, s->rank, task->x);
+    }
+    set_num_threads(prev);
+}
+
+static PyObject *
+xorsat_solve_many(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "solvers", "workers", "format", NULL };
+    model_format_t format = MODEL_DICT;
+    PyObject *arg, *seq, **items, *result = NULL, *model;
+    SolverObject *s;
+    solve_task_t *tasks;
+    Py_ssize_t size, claimed = 0, i, j;
+    double total = 0;
+    int workers = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O&$O&", kwlist, &arg,
+                                     threads_converter, &workers,
+                                     model_format_converter, &format))
+        return NULL;
+    if (workers == 0)
+        workers = cpu_count();
+
+    seq = PySequence_Fast(arg, "argument is not iterable");
+    if (seq == NULL)
+        return NULL;
+    size = PySequence_Fast_GET_SIZE(seq);
+    items = PySequence_Fast_ITEMS(seq);
+    tasks = PyMem_Calloc(size + 1, sizeof(solve_task_t));
+    if (tasks == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    // Claim every solver up front, so that none of them can change while the workers
+    // run without the GIL
+    for (i = 0; i < size; i++) {
+        if (!PyObject_TypeCheck(items[i], &Solver_Type)) {
+            PyErr_Format(PyExc_TypeError, "expected iterable of Solvers, got: '%.200s'",
+                Py_TYPE(items[i])->tp_name);
+            goto done;
+        }
+        s = (SolverObject *)items[i];
+        if (s->busy) {
+            for (j = 0; j < claimed && tasks[j].solver != s; j++)
+                ;
+            if (j < claimed)
+                PyErr_SetString(PyExc_ValueError, "iterable cannot contain a solver twice");
+            else
+                solver_check_busy(s);
+            goto done;
+        }
+        if (s->system == NULL) {
+            PyErr_SetString(PyExc_ValueError, "solver does not contain any equations");
+            goto done;
+        }
+        s->busy = 1;
+        tasks[claimed].solver = s;
+        tasks[claimed].index = i;
+        tasks[claimed].cost = (double)s->nrows * s->rows->ncols;
+        total += tasks[claimed].cost;
+        claimed++;
+    }
+
+    // A system gets OpenMP threads in proportion to its share of the work, so that a
+    // few huge systems still spread over all workers
+    for (i = 0; i < size; i++) {
+        tasks[i].threads = total > 0 ? (int)(workers * tasks[i].cost / total) : 1;
+        tasks[i].threads = Py_MAX(1, Py_MIN(tasks[i].threads, workers));
+    }
+    qsort(tasks, size, sizeof(solve_task_t), solve_task_compare);
+
+    Py_BEGIN_ALLOW_THREADS
+    worker_pool_map(solve_task_reduce, tasks, size, workers);
+    Py_END_ALLOW_THREADS
+
+    // Recording rows for pop() needs the GIL. If it fails, the reduced rows simply
+    // stay pending.
+    for (i = 0; i < size; i++) {
+        s = tasks[i].solver;
+        if (solver_save_rows(s, s->rank, s->pivots + s->rank, tasks[i].added) < 0)
+            goto done;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    worker_pool_map(solve_task_finish, tasks, size, workers);
+    Py_END_ALLOW_THREADS
+
+    result = PyList_New(size);
+    if (result == NULL)
+        goto done;
+    for (i = 0; i < size; i++) {
+        if (tasks[i].x == NULL) {
+            PyList_SET_ITEM(result, tasks[i].index, Py_NewRef(Py_None));
+            continue;
+        }
+        model = generate_model(tasks[i].x, (LinearSystemObject *)tasks[i].solver->system,
+                               format);
+        if (model == NULL) {
+            Py_CLEAR(result);
+            goto done;
+        }
+        PyList_SET_ITEM(result, tasks[i].index, model);
+    }
+
+done:
+    for (i = 0; i < claimed; i++) {
+        tasks[i].solver->busy = 0;
+        mzd_xfree(tasks[i].x);
+    }
+    PyMem_Free(tasks);
+    Py_DECREF(seq);
+    return result;
+}
+
 static PyMethodDef xorsat_methods[] = {
     { "LShR", (_PyCFunctionFast)xorsat_lshr, METH_FASTCALL, NULL },
     { "RotL", (_PyCFunctionFast)xorsat_rotl, METH_FASTCALL, NULL },
     { "RotR", (_PyCFunctionFast)xorsat_rotr, METH_FASTCALL, NULL },
     { "Par", (PyCFunction)xorsat_par, METH_O, NULL },
     { "Broadcast", (PyCFunction)xorsat_broadcast, METH_VARARGS, NULL },
-    { "_solve_zeros", (PyCFunction)xorsat__solve_zeros, METH_VARARGS, NULL },
+    { "stack_masks", (PyCFunction)xorsat_stack_masks, METH_O, NULL },
+    { "solve_many", (PyCFunction)xorsat_solve_many, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "solve_zeros", (PyCFunction)xorsat_solve_zeros, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "_solve_zeros", (PyCFunction)xorsat_solve_zeros,
+      METH_VARARGS | METH_KEYWORDS, NULL },
     { NULL },
 };
 
@@ -1761,13 +7160,18 @@ PyInit__xorsat(void)
 }
 
     INIT_TYPE(BitExpr_Type);
+    INIT_TYPE(BitMatrix_Type);
     INIT_TYPE(BitRef_Type);
     INIT_TYPE(BitSet_Type);
     INIT_TYPE(BitVec_Type);
     INIT_TYPE(BitVecConstraint_Type);
     INIT_TYPE(Constraint_Type);
+    INIT_TYPE(Factorization_Type);
+    INIT_TYPE(LinearMap_Type);
     INIT_TYPE(LinearSystem_Type);
+    INIT_TYPE(MTEngine_Type);
     INIT_TYPE(SolveIter_Type);
+    INIT_TYPE(Solver_Type);
     INIT_TYPE(VarInfo_Type);
 
     mod = PyModule_Create(&_xorsatmodule);
@@ -1782,9 +7186,14 @@ PyInit__xorsat(void)
 }
 
     ADD_TYPE(BitExpr_Type);
+    ADD_TYPE(BitMatrix_Type);
     ADD_TYPE(BitSet_Type);
     ADD_TYPE(BitVec_Type);
+    ADD_TYPE(Factorization_Type);
+    ADD_TYPE(LinearMap_Type);
     ADD_TYPE(LinearSystem_Type);
+    ADD_TYPE(MTEngine_Type);
+    ADD_TYPE(Solver_Type);
 
     return mod;
 }
@@ -1,3 +1,5 @@
+import copy
+
 from xorsat import *
 
 def _lshr(x, k):
@@ -12,7 +14,8 @@ class MersenneTwister:
         if len(mt) != n or min(r, u, s, t, l) > w and max(a, b, c, d) > w1:
             raise ValueError('invalid parameters')
 
-        self.mt = list(mt)
+        self._engine = None
+        self.mt = mt
         self.w = w
         self.n = n
         self.m = m
@@ -30,12 +33,61 @@ class MersenneTwister:
         self.lmsk = w1 & ((1 << r) - 1)
         self.umsk = w1 ^ self.lmsk
         self.mti = 0
+        self._block = None
+
+    # While the native engine is in use it owns the state, so mt and mti are read back
+    # from it the next time Python code touches them
+    @property
+    def mt(self):
+        self._sync()
+        return self._mt
+
+    @mt.setter
+    def mt(self, value):
+        self._sync()
+        self._mt = list(value)
+
+    @property
+    def mti(self):
+        self._sync()
+        return self._mti
+
+    @mti.setter
+    def mti(self, value):
+        self._sync()
+        self._mti = value
+
+    def _sync(self):
+        if self._engine is not None:
+            self._mt, self._mti = self._engine.state(), self._engine.mti
+            self._engine = None
+
+    def _native(self):
+        if self._engine is None:
+            self._engine = MTEngine(self.mt, self.mti, self.w, self.n, self.m, self.r,
+                                    self.a, self.u, self.d, self.s, self.b, self.t,
+                                    self.c, self.l)
+        return self._engine
+
+    def add_getrandbits(self, solver, outputs, k=None):
+        """Adds getrandbits(k) == out to solver for each out in outputs, in order; None
+        skips an output. Gives the same equations as adding the BitVecs returned by
+        getrandbits() one by one, but generates them natively."""
+        if k is None:
+            k = self.w
+        self._native().getrandbits(solver, outputs, k)
+
+    def add_random(self, solver, outputs):
+        """Like add_getrandbits(), for the floats returned by CPython's random()"""
+        self._native().random(solver, outputs)
 
     def twist(self):
-        i = self.mti
-        y = (self.mt[i] & self.umsk) ^ (self.mt[(i + 1) % self.n] & self.lmsk)
+        if self._engine is not None:
+            self._sync()
+        mt, i = self._mt, self._mti
+        y = (mt[i] & self.umsk) ^ (mt[(i + 1) % self.n] & self.lmsk)
         sel = Broadcast(y, 0) & self.a if isinstance(y, BitVec) else (y & 1) * self.a
-        self.mt[i] = self.mt[(i + self.m) % self.n] ^ _lshr(y, 1) ^ sel
+        mt[i] = mt[(i + self.m) % self.n] ^ _lshr(y, 1) ^ sel
 
     def temper(self, y):
         y ^= _lshr(y, self.u) & self.d
@@ -44,10 +96,54 @@ class MersenneTwister:
         y ^= _lshr(y, self.l)
         return y
 
+    def _step(self):
+        self.twist()
+        self._mti = (self._mti + 1) % self.n
+
+    def _block_map(self):
+        """The LinearMap of n consecutive twists starting at mti == 0, acting on the whole
+        state packed into n * w bits"""
+        if self._block is None:
+            def block(state):
+                bits = list(state)
+                rng = copy.copy(self)
+                rng.mt = [BitVec(bits[i:i + self.w]) for i in range(0, len(bits), self.w)]
+                rng.mti = 0
+                for _ in range(self.n):
+                    rng._step()
+                return BitVec([b for x in rng.mt for b in x])
+            self._block = LinearMap.trace(block, self.n * self.w)
+        return self._block
+
+    def jump(self, k):
+        """Advances the generator by k outputs without producing them. Whole blocks of n
+        outputs are skipped with a power of the twist map, so k can be very large."""
+        if k < 0:
+            raise ValueError('cannot jump backwards')
+        while k > 0 and self.mti != 0:
+            self._step()
+            k -= 1
+        q, k = divmod(k, self.n)
+        if q:
+            f = self._block_map() ** q
+            if all(isinstance(x, int) for x in self.mt):
+                y = f(sum(x << (i * self.w) for i, x in enumerate(self.mt)))
+                self.mt = [(y >> (i * self.w)) & self.w1 for i in range(self.n)]
+            else:
+                bits = []
+                for x in self.mt:
+                    if not isinstance(x, BitVec):
+                        raise TypeError('state must be all ints or all BitVecs')
+                    bits.extend(x)
+                y = list(f(BitVec(bits)))
+                self.mt = [BitVec(y[i:i + self.w]) for i in range(0, len(y), self.w)]
+        for _ in range(k):
+            self._step()
+
     def __call__(self):
         self.twist()
-        y = self.mt[self.mti]
-        self.mti = (self.mti + 1) % self.n
+        y = self._mt[self._mti]
+        self._mti = (self._mti + 1) % self.n
         return self.temper(y)
 
     def getrandbits(self, k=None):
@@ -8,6 +8,14 @@ typedef enum {
     SHIFT_SHL, SHIFT_SHR, SHIFT_SAR, SHIFT_ROL, SHIFT_ROR
 } shift_t;
 
+typedef enum {
+    MODEL_DICT, MODEL_BYTES
+} model_format_t;
+
+typedef enum {
+    SOLVE_AUTO, SOLVE_DENSE, SOLVE_SPARSE
+} solve_method_t;
+
 typedef uint64_t bitset_t;
 
 #define WORD_SIZE (8 * sizeof(bitset_t))
@@ -22,9 +30,20 @@ typedef struct {
 typedef struct {
     PyObject_VAR_HEAD
     Py_ssize_t bits;
+    Py_ssize_t count;   /* number of set bits, or -1 until it is counted */
+    Py_ssize_t words;   /* BS_SIZE(bits), the length of the buffer export */
+    bitset_t *dense;    /* words of a sparse set, built on the first buffer export */
+    uint8_t sparse;     /* buf holds the sorted indices of the set bits, not words */
     bitset_t buf[1];
 } BitSetObject;
 
+typedef struct {
+    PyObject_HEAD
+    mzd_t *M;
+    Py_ssize_t shape[2];    /* buffer export of M, in words */
+    Py_ssize_t strides[2];
+} BitMatrixObject;
+
 typedef struct {
     PyObject_HEAD
     PyObject *system;   /* LinearSystem */
@@ -32,10 +51,14 @@ typedef struct {
     uint8_t compl;
 } BitExprObject;
 
+/* Column of the constant term in the rows of a packed BitVec, just past the mask words */
+#define BV_CONST_COL(bits) (BS_SIZE(bits) * WORD_SIZE)
+
 typedef struct {
     PyObject_VAR_HEAD
     PyObject *system;
-    PyObject *exprs[1];
+    mzd_t *M;           /* packed coefficients, one row per bit, or NULL */
+    PyObject *exprs[1]; /* for a packed vector, built from the rows of M on first access */
 } BitVecObject;
 
 typedef struct {
@@ -60,15 +83,154 @@ typedef struct {
     PyObject *system;
     mzd_t *x;
     mzd_t *kernel;
-    uint8_t *state;
+    uint64_t index;     /* number of solutions produced so far */
+    model_format_t format;
+    uint8_t done;
 } SolveIterObject;
 
+typedef struct {
+    void (*func)(void *arg, Py_ssize_t i);
+    void *arg;
+    Py_ssize_t ntasks;
+    Py_ssize_t next;    /* next task to hand out, updated atomically */
+} worker_pool_t;
+
+typedef struct {
+    rci_t rank;         /* basis size when the checkpoint was pushed */
+    Py_ssize_t undo;    /* length of the undo log when the checkpoint was pushed */
+    uint64_t epoch;
+    uint8_t inconsistent;
+} solver_checkpoint_t;
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *system;   /* LinearSystem, bound by the first constraint */
+    mzd_t *rows;        /* augmented row store, with room for rows->nrows equations */
+    rci_t nrows;
+    rci_t rank;         /* rows [0, rank) are the basis, [rank, nrows) are pending */
+    rci_t *pivots;      /* pivot column of each basis row */
+    uint8_t inconsistent;
+    solver_checkpoint_t *checkpoints;
+    Py_ssize_t ncheckpoints;
+    mzd_t *undo;        /* basis rows as they were before a merge touched them */
+    rci_t *undo_rows;   /* where each row of the undo log belongs */
+    Py_ssize_t nundo;
+    uint64_t *saved;    /* epoch of the checkpoint each basis row was last saved for */
+    uint64_t epoch;
+    uint8_t busy;       /* set while eliminating with the GIL released */
+    int cancelled;      /* set by cancel() from another thread, read atomically */
+} SolverObject;
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *system;
+    rci_t nrows;        /* number of equations the factorization was built from */
+    rci_t rank;
+    mzd_t *R;           /* reduced row echelon form of the coefficients, rank x bits */
+    rci_t *pivots;      /* pivot column of each row of R */
+    mzd_t *Tt;          /* transpose of the row transform T, with T * A = [R; 0] */
+    mzd_t *offset;      /* constant term of each equation, 1 x nrows */
+    mzd_t *kernel;      /* transposed kernel of R, built on first use */
+} FactorizationObject;
+
+typedef struct {
+    PyObject_HEAD
+    mzd_t *A;           /* linear part, out_width x in_width */
+    mzd_t *c;           /* constant part, out_width x 1 */
+} LinearMapObject;
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *system;
+    mzd_t *S;           /* state, row i * w + j is bit j of word i, laid out like a packed
+                           BitVec, and a scratch row for a twist */
+    rci_t *idx;         /* sorted columns of each row that is still sparse */
+    int *len;           /* number of columns of each row in idx, or -1 if it lives in S */
+    uint64_t T[64];     /* tempering: output bit k is the XOR of the bits of the word set
+                           in T[k] */
+    uint64_t a;
+    int w, n, m, r;
+    Py_ssize_t mti;
+} MTEngineObject;
+
+typedef struct {
+    rci_t rows, cols;   /* of the system, without the right-hand side column */
+    rci_t *parent;      /* union-find over the columns, with cols standing for the constant 0 */
+    uint8_t *parity;    /* x[c] = x[parent[c]] ^ parity[c] */
+    word *merged;       /* columns that are no longer roots */
+    uint8_t *state;     /* PRESOLVE_* state of each row */
+    rci_t *count;       /* number of active rows containing each column */
+    rci_t *owner;       /* XOR of the indices of those rows */
+    rci_t *peeled;      /* rows solved for a singleton column, in the order they were removed */
+    rci_t *peeled_cols;
+    rci_t npeeled;
+    rci_t *index;       /* column of each variable in the core, or -1 if it was eliminated */
+    rci_t *core;        /* variable of each column of the core */
+    rci_t ncore;
+} presolve_t;
+
+typedef struct {
+    mzd_t *A;           /* augmented rows of the component */
+    rci_t *cols;        /* column of the system for each column of A */
+    double cost;
+    int threads;        /* OpenMP threads the component may use */
+    int err;            /* -1 if the component has no solution */
+    uint8_t all;        /* whether to compute the kernel as well */
+    mzd_t *x;
+    mzd_t *kernel;
+} component_t;
+
+typedef struct {
+    rci_t *items;
+    rci_t len, cap;
+} index_list_t;
+
+typedef struct {
+    rci_t rows, cols;
+    index_list_t *row;  /* sorted columns of each row */
+    uint8_t *rhs;
+    uint8_t *state;     /* SPARSE_* state of each row */
+    index_list_t *occ;  /* rows each column was added to, some of which may have lost it */
+    rci_t *weight;      /* number of active rows containing each column */
+    rci_t *pivots;      /* eliminated rows in order, each solved for its pivot column */
+    rci_t *pivot_cols;
+    rci_t npivots;
+    index_list_t scratch;
+    uint8_t nomem;      /* set if an allocation failed without the GIL */
+} sparse_t;
+
+typedef struct {
+    rci_t nrows, ncols;
+    Py_ssize_t *rowptr; /* rows, with the right-hand side as the last column */
+    rci_t *rowidx;
+    Py_ssize_t *colptr; /* the same matrix by columns */
+    rci_t *colidx;
+} sparse_matrix_t;
+
+typedef struct {
+    PyObject *iter;
+    PyObject *system;   /* LinearSystem, bound by the first BitExpr if not given */
+    PyObject *item;     /* item the next row comes from, or NULL at the end */
+    rci_t next;         /* next row of item, if it is a BitMatrix */
+    Py_ssize_t nrows;   /* rows read so far */
+} row_reader_t;
+
+typedef struct {
+    SolverObject *solver;
+    Py_ssize_t index;   /* position in the argument of solve_many() */
+    double cost;
+    int threads;        /* OpenMP threads the task may use */
+    rci_t added;
+    mzd_t *x;
+} solve_task_t;
+
 typedef struct {
     PyObject_HEAD
     PyObject **vi_table;
     Py_ssize_t vi_size;
     Py_ssize_t bits;
     PyObject *_expr_const[2];
+    PyObject **gen_table;   /* BitExpr of each bit, filled in as gens are requested */
 } LinearSystemObject;
 
 #define BitExpr_Check(obj) PyObject_TypeCheck((obj), &BitExpr_Type)
@@ -80,12 +242,17 @@ PyObject *varinfo_create(PyTypeObject *type, PyObject *name, Py_ssize_t bits,
 PyObject *bitref_create(PyTypeObject *type, VarInfoObject *var, Py_ssize_t index);
 
 uint8_t bitset_test(BitSetObject *bs, Py_ssize_t i);
-void bitset_set(BitSetObject *bs, Py_ssize_t i, uint8_t val);
+Py_ssize_t bitset_next(BitSetObject *bs, Py_ssize_t i);
+void bitset_xor_into(BitSetObject *bs, bitset_t *words);
 PyObject *bitset_from_size(PyTypeObject *type, Py_ssize_t bits, int clear);
-void bitset_inplace_xor(BitSetObject *a, BitSetObject *b);
+PyObject *bitset_from_indices(PyTypeObject *type, Py_ssize_t bits, const bitset_t *indices,
+                              Py_ssize_t n);
+PyObject *bitset_from_words(PyTypeObject *type, Py_ssize_t bits, const bitset_t *words);
 PyObject *bitset_xor_impl(BitSetObject *a, BitSetObject *b);
 Py_ssize_t bitset_count_impl(BitSetObject *bs);
 
+PyObject *bitmatrix_create(PyTypeObject *type, mzd_t *M);
+
 PyObject *bitexpr_copy(BitExprObject *expr);
 PyObject *bitexpr_from_bit(PyTypeObject *type, uint8_t bit, LinearSystemObject *system);
 int getbit(PyObject *num, const char *message);
@@ -95,13 +262,21 @@ PyObject *bitexpr_xor_bitexpr(BitExprObject *a, BitExprObject *b);
 
 PyObject *bitvec_from_size(PyTypeObject *type, Py_ssize_t size, PyObject *system,
                            int zero);
+PyObject *bitvec_from_matrix(PyTypeObject *type, Py_ssize_t size, PyObject *system);
+PyObject *bitvec_pack_impl(BitVecObject *vec);
+PyObject *bitvec_get(BitVecObject *vec, Py_ssize_t i);
 PyObject *bitvec_bitwise_number(BitVecObject *vec, const char op, PyObject *num);
 
 PyObject *constraint_create(PyTypeObject *type, PyObject *lhs, PyObject *rhs);
 
 PyObject *linearsystem_gen_index(LinearSystemObject *self, Py_ssize_t index);
 
-PyObject *generate_model(mzd_t *x, LinearSystemObject *system);
+int model_format_converter(PyObject *arg, void *ptr);
+int solve_method_converter(PyObject *arg, void *ptr);
+int threads_converter(PyObject *arg, void *ptr);
+PyObject *generate_model(mzd_t *x, LinearSystemObject *system, model_format_t format);
+PyObject *solve_matrix(LinearSystemObject *system, mzd_t *M, int all, model_format_t format,
+                       int threads);
 
 PyObject *mzd_xfree(mzd_t *A)
 {